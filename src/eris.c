@@ -23,10 +23,14 @@ THE SOFTWARE.
 
 /* Standard library headers. */
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 /* Not using stdbool because Visual Studio lives in the past... */
 #ifndef __cplusplus
@@ -55,6 +59,28 @@ typedef int bool;
 /* Eris header. */
 #include "eris.h"
 
+/* Threading support for the prefetching reader. */
+#if defined(LUA_USE_PTHREAD)
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+/* Hardware accelerated checksums. */
+#if defined(__GNUC__) && defined(__x86_64__)
+#define ERIS_CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
+
+/* File syncing for autosaves, memory mapping for bundles. */
+#if defined(LUA_USE_POSIX)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#elif defined(LUA_WIN)
+#include <windows.h>
+#endif
+
 /*
 ** {===========================================================================
 ** Default settings.
@@ -90,6 +116,25 @@ static const bool kGeneratePath = false;
  * used to avoid segfaults when writing or reading user data. */
 static const lua_Unsigned kMaxComplexity = 10000;
 
+/* Whether to write integral numbers in a compact, variable length encoding
+ * instead of their full binary representation. This usually shrinks the
+ * output considerably, since most numbers in a typical state are small
+ * integers (counters, ids, indices), but produces data that can only be read
+ * by Eris versions supporting it, so it is disabled per default. */
+static const bool kCompactNumbers = false;
+
+/* The maximum number of bytes an unpersist call may allocate, zero meaning no
+ * limit. This is a net value: memory freed during the call, e.g. by the GC,
+ * is available again. Useful to bound the memory used when loading data from
+ * untrusted sources. */
+static const lua_Unsigned kMaxMemory = 0;
+
+/* Whether to append a CRC-32C checksum of the data, which is verified when
+ * unpersisting. This way corrupted data is reported as such, instead of
+ * failing somewhere in the middle or, worse, loading successfully. Data with
+ * a checksum can only be read by Eris versions supporting it. */
+static const bool kChecksum = false;
+
 /*
 ** ============================================================================
 ** Lua internals interfacing.
@@ -112,6 +157,10 @@ static const lua_Unsigned kMaxComplexity = 10000;
 #define eris_savestack savestack
 #define eris_restorestack restorestack
 #define eris_reallocstack luaD_reallocstack
+#define eris_pcall luaD_pcall
+#define eris_throw luaD_throw
+/* Mirrors ERRORSTACKSIZE in ldo.c, the largest stack a thread can have. */
+#define eris_maxstacksize (LUAI_MAXSTACK + 200)
 /* lfunc.h */
 #define eris_newproto luaF_newproto
 #define eris_newLclosure luaF_newLclosure
@@ -183,12 +232,19 @@ extern void eris_permstrlib(lua_State *L, int forUnpersist);
 ** ============================================================================
 */
 
+#define ERIS_ERR_FLAGS "unsupported format flags (%d)"
+#define ERIS_ERR_FILE "cannot %s '%s' (%s)"
+#define ERIS_ERR_BUNDLE "invalid bundle '%s'"
+#define ERIS_ERR_CHECKSUM "checksum mismatch, data is corrupted"
 #define ERIS_ERR_CFUNC "attempt to persist a light C function (%p)"
 #define ERIS_ERR_COMPLEXITY "object too complex"
 #define ERIS_ERR_HOOK "cannot persist yielded hooks"
+#define ERIS_ERR_MAXMEM "memory limit exceeded (%f bytes)"
+#define ERIS_ERR_MANY "invalid data (not written by persist_many)"
 #define ERIS_ERR_METATABLE "bad metatable, not nil or table"
 #define ERIS_ERR_NOFUNC "attempt to persist unknown function type"
 #define ERIS_ERR_READ "could not read data"
+#define ERIS_ERR_SIZE "invalid %s size"
 #define ERIS_ERR_SPER_FUNC "%s did not return a function"
 #define ERIS_ERR_SPER_LOAD "bad unpersist function (%s expected, returned %s)"
 #define ERIS_ERR_SPER_PROT "attempt to persist forbidden table"
@@ -213,6 +269,7 @@ extern void eris_permstrlib(lua_State *L, int forUnpersist);
 #define ERIS_ERR_UCFUNC "bad C closure (C function expected, got %s)"
 #define ERIS_ERR_UCFUNCNULL "bad C closure (C function expected, got null)"
 #define ERIS_ERR_USERDATA "attempt to literally persist userdata"
+#define ERIS_ERR_VARINT "malformed variable length integer"
 #define ERIS_ERR_WRITE "could not write data"
 #define ERIS_ERR_REF "invalid reference #%d. this usually means a special "\
                       "persistence callback of a table referenced said table "\
@@ -257,13 +314,23 @@ typedef struct PersistInfo {
   void *ud;
   const char *metafield;
   bool writeDebugInfo;
+  bool compactNumbers;
+  bool checksum;
 } PersistInfo;
 
+struct Info;
+
 /* State information when unpersisting an object. */
 typedef struct UnpersistInfo {
   ZIO zio;
-  size_t sizeof_int;
-  size_t sizeof_size_t;
+  /* Readers for int and size_t values, picked based on the header. */
+  int (*read_int)(struct Info*);
+  size_t (*read_size_t)(struct Info*);
+  bool compactNumbers;
+  bool checksum;
+  /* Whether the reader delivers all input in one chunk, in which case the
+   * bytes left in the ZIO are all that remains of the input. */
+  bool wholeInput;
 } UnpersistInfo;
 
 /* Info shared in persist and unpersist. */
@@ -274,6 +341,9 @@ typedef struct Info {
   lua_Unsigned maxComplexity;
   bool generatePath;
   bool passIOToPersist;
+  /* Whether the reference table falls back to the one of a shared section
+   * via its __index, see persist_many. */
+  bool sharedRefs;
   /* Which one it really is will always be clear from the context. */
   union {
     PersistInfo pi;
@@ -296,6 +366,9 @@ static const char *const kSettingPassIOToPersist = "spio";
 static const char *const kSettingGeneratePath = "path";
 static const char *const kSettingWriteDebugInfo = "debug";
 static const char *const kSettingMaxComplexity = "maxrec";
+static const char *const kSettingCompactNumbers = "compact";
+static const char *const kSettingMaxMemory = "maxmem";
+static const char *const kSettingChecksum = "checksum";
 
 /* Header we prefix to persisted data for a quick check when unpersisting. */
 static char const kHeader[] = { 'E', 'R', 'I', 'S' };
@@ -304,6 +377,21 @@ static char const kHeader[] = { 'E', 'R', 'I', 'S' };
 /* Floating point number used to check compatibility of loaded data. */
 static const lua_Number kHeaderNumber = (lua_Number)-1.234567890;
 
+/* Set in the sizeof(lua_Number) field of the header if a byte with format
+ * flags follows the sizeof(size_t) field. Data written without any optional
+ * format features has no flags field, so it stays readable by older versions,
+ * which will reject data with flags as having an incompatible number type. */
+#define HEADER_HAS_FLAGS 0x80
+
+/* Format flags, see above. */
+#define FLAG_COMPACT_NUMBERS 0x01
+#define FLAG_CHECKSUM 0x02
+#define FLAGS_SUPPORTED (FLAG_COMPACT_NUMBERS | FLAG_CHECKSUM)
+
+/* Integral numbers with a magnitude up to this are written in compact form.
+ * This is the range in which a double can represent all integers exactly. */
+#define COMPACT_NUMBER_MAX ((lua_Number)9007199254740992.0)
+
 /* Stack indices of some internal values/tables, to avoid magic numbers. */
 #define PERMIDX 1
 #define REFTIDX 2
@@ -510,28 +598,41 @@ write_uint8_t(Info *info, uint8_t value) {
 
 static void
 write_uint16_t(Info *info, uint16_t value) {
-  write_uint8_t(info, value);
-  write_uint8_t(info, value >> 8);
+  uint8_t bytes[2];
+  bytes[0] = (uint8_t)value;
+  bytes[1] = (uint8_t)(value >> 8);
+  WRITE_RAW(bytes, sizeof(bytes));
+}
+
+/* Encodes a little endian value into memory, for data not written via info. */
+static void
+encode_uint32_t(void *p, uint32_t value) {
+  uint8_t *bytes = (uint8_t*)p;
+  bytes[0] = (uint8_t)value;
+  bytes[1] = (uint8_t)(value >> 8);
+  bytes[2] = (uint8_t)(value >> 16);
+  bytes[3] = (uint8_t)(value >> 24);
 }
 
 static void
 write_uint32_t(Info *info, uint32_t value) {
-  write_uint8_t(info, value);
-  write_uint8_t(info, value >> 8);
-  write_uint8_t(info, value >> 16);
-  write_uint8_t(info, value >> 24);
+  uint8_t bytes[4];
+  encode_uint32_t(bytes, value);
+  WRITE_RAW(bytes, sizeof(bytes));
 }
 
 static void
 write_uint64_t(Info *info, uint64_t value) {
-  write_uint8_t(info, value);
-  write_uint8_t(info, value >> 8);
-  write_uint8_t(info, value >> 16);
-  write_uint8_t(info, value >> 24);
-  write_uint8_t(info, value >> 32);
-  write_uint8_t(info, value >> 40);
-  write_uint8_t(info, value >> 48);
-  write_uint8_t(info, value >> 56);
+  uint8_t bytes[8];
+  bytes[0] = (uint8_t)value;
+  bytes[1] = (uint8_t)(value >> 8);
+  bytes[2] = (uint8_t)(value >> 16);
+  bytes[3] = (uint8_t)(value >> 24);
+  bytes[4] = (uint8_t)(value >> 32);
+  bytes[5] = (uint8_t)(value >> 40);
+  bytes[6] = (uint8_t)(value >> 48);
+  bytes[7] = (uint8_t)(value >> 56);
+  WRITE_RAW(bytes, sizeof(bytes));
 }
 
 static void
@@ -611,6 +712,46 @@ write_lua_Number(Info *info, lua_Number value) {
   }
 }
 
+/* Writes an unsigned integer in a variable length encoding: seven bits per
+ * byte, least significant group first, high bit set if more bytes follow. */
+static void
+write_varint(Info *info, uint64_t value) {
+  uint8_t buffer[10];
+  size_t length = 0;
+  while (value >= 0x80) {
+    buffer[length++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  buffer[length++] = (uint8_t)value;
+  WRITE_RAW(buffer, length);
+}
+
+/* Writes a number value, in compact form if enabled. The compact form is a
+ * varint with the lowest bit cleared for integral values, where the remaining
+ * bits are the zigzag encoded integer. Anything else (fractions, huge values,
+ * negative zero, infinities and NaNs) is written as the varint 1 followed by
+ * the full binary representation, so decoding is always bit-exact. */
+static void
+write_number(Info *info, lua_Number value) {
+  static const lua_Number zero = 0;
+  if (!info->u.pi.compactNumbers) {
+    write_lua_Number(info, value);
+  }
+  else if (value >= -COMPACT_NUMBER_MAX && value <= COMPACT_NUMBER_MAX &&
+           (lua_Number)(int64_t)value == value &&
+           (value != 0 || memcmp(&value, &zero, sizeof(lua_Number)) == 0))
+  {
+    const int64_t integer = (int64_t)value;
+    const uint64_t zigzag = integer < 0 ? ~((uint64_t)integer << 1)
+                                        : (uint64_t)integer << 1;
+    write_varint(info, zigzag << 1);
+  }
+  else {
+    write_varint(info, 1);
+    write_lua_Number(info, value);
+  }
+}
+
 /* Note that Lua only ever uses 32 bits of the Instruction type, so we can
  * assert that there will be no truncation, even if the underlying type has
  * more bits (might be the case on some 64 bit systems). */
@@ -639,28 +780,47 @@ read_uint8_t(Info *info) {
 
 static uint16_t
 read_uint16_t(Info *info) {
-  return  (uint16_t)read_uint8_t(info) |
-         ((uint16_t)read_uint8_t(info) << 8);
+  uint8_t bytes[2];
+  READ_RAW(bytes, sizeof(bytes));
+  return  (uint16_t)bytes[0] |
+         ((uint16_t)bytes[1] << 8);
+}
+
+/* Decodes a little endian value from memory we already have. */
+static uint32_t
+decode_uint32_t(const void *p) {
+  const uint8_t *bytes = (const uint8_t*)p;
+  return  (uint32_t)bytes[0] |
+         ((uint32_t)bytes[1] << 8) |
+         ((uint32_t)bytes[2] << 16) |
+         ((uint32_t)bytes[3] << 24);
 }
 
 static uint32_t
 read_uint32_t(Info *info) {
-  return  (uint32_t)read_uint8_t(info) |
-         ((uint32_t)read_uint8_t(info) << 8) |
-         ((uint32_t)read_uint8_t(info) << 16) |
-         ((uint32_t)read_uint8_t(info) << 24);
+  uint8_t bytes[4];
+  READ_RAW(bytes, sizeof(bytes));
+  return decode_uint32_t(bytes);
+}
+
+static uint64_t
+decode_uint64_t(const void *p) {
+  const uint8_t *bytes = (const uint8_t*)p;
+  return  (uint64_t)bytes[0] |
+         ((uint64_t)bytes[1] << 8) |
+         ((uint64_t)bytes[2] << 16) |
+         ((uint64_t)bytes[3] << 24) |
+         ((uint64_t)bytes[4] << 32) |
+         ((uint64_t)bytes[5] << 40) |
+         ((uint64_t)bytes[6] << 48) |
+         ((uint64_t)bytes[7] << 56);
 }
 
 static uint64_t
 read_uint64_t(Info *info) {
-  return  (uint64_t)read_uint8_t(info) |
-         ((uint64_t)read_uint8_t(info) << 8) |
-         ((uint64_t)read_uint8_t(info) << 16) |
-         ((uint64_t)read_uint8_t(info) << 24) |
-         ((uint64_t)read_uint8_t(info) << 32) |
-         ((uint64_t)read_uint8_t(info) << 40) |
-         ((uint64_t)read_uint8_t(info) << 48) |
-         ((uint64_t)read_uint8_t(info) << 56);
+  uint8_t bytes[8];
+  READ_RAW(bytes, sizeof(bytes));
+  return decode_uint64_t(bytes);
 }
 
 static int16_t
@@ -694,73 +854,41 @@ read_float64(Info *info) {
   return value;
 }
 
-/* Note regarding the following: unlike with writing the sizeof check will be
- * impossible to optimize away, since it depends on the input; however, the
- * truncation check may be optimized away in the case where the read data size
- * equals the native one, so reading data written on the same machine should be
- * reasonably quick. Doing a (rather rudimentary) benchmark this did not have
- * any measurable impact on performance. */
+/* Unlike with writing, the size of int and size_t values depends on the
+ * input, so we pick specialized readers for them once, in u_header, instead
+ * of checking the persisted size for every single value. The sizeof checks in
+ * these are constant, so readers for data with the native or a smaller size
+ * contain no truncation check at all; only those for data with a larger size
+ * than the native one check for truncation. */
+
+#define READ_INTEGRAL(name, type, ptype, err) \
+static type \
+name(Info *info) { \
+  const ptype pvalue = read_##ptype(info); \
+  const type value = (type)pvalue; \
+  if (sizeof(type) < sizeof(ptype) && (ptype)value != pvalue) { \
+    eris_error(info, err); \
+  } \
+  return value; \
+}
+
+READ_INTEGRAL(read_int_int16, int, int16_t, ERIS_ERR_TRUNC_INT)
+READ_INTEGRAL(read_int_int32, int, int32_t, ERIS_ERR_TRUNC_INT)
+READ_INTEGRAL(read_int_int64, int, int64_t, ERIS_ERR_TRUNC_INT)
+READ_INTEGRAL(read_size_t_uint16, size_t, uint16_t, ERIS_ERR_TRUNC_SIZE)
+READ_INTEGRAL(read_size_t_uint32, size_t, uint32_t, ERIS_ERR_TRUNC_SIZE)
+READ_INTEGRAL(read_size_t_uint64, size_t, uint64_t, ERIS_ERR_TRUNC_SIZE)
+
+#undef READ_INTEGRAL
 
 static int
 read_int(Info *info) {
-  int value;
-  if (info->u.upi.sizeof_int == sizeof(int16_t)) {
-    int16_t pvalue = read_int16_t(info);
-    value = (int)pvalue;
-    if ((int32_t)value != pvalue) {
-      eris_error(info, ERIS_ERR_TRUNC_INT);
-    }
-  }
-  else if (info->u.upi.sizeof_int == sizeof(int32_t)) {
-    int32_t pvalue = read_int32_t(info);
-    value = (int)pvalue;
-    if ((int32_t)value != pvalue) {
-      eris_error(info, ERIS_ERR_TRUNC_INT);
-    }
-  }
-  else if (info->u.upi.sizeof_int == sizeof(int64_t)) {
-    int64_t pvalue = read_int64_t(info);
-    value = (int)pvalue;
-    if ((int64_t)value != pvalue) {
-      eris_error(info, ERIS_ERR_TRUNC_INT);
-    }
-  }
-  else {
-    eris_error(info, ERIS_ERR_TYPE_INT);
-    value = 0; /* not reached */
-  }
-  return value;
+  return info->u.upi.read_int(info);
 }
 
 static size_t
 read_size_t(Info *info) {
-  size_t value;
-  if (info->u.upi.sizeof_size_t == sizeof(uint16_t)) {
-    uint16_t pvalue = read_uint16_t(info);
-    value = (size_t)pvalue;
-    if ((uint32_t)value != pvalue) {
-      eris_error(info, ERIS_ERR_TRUNC_SIZE);
-    }
-  }
-  else if (info->u.upi.sizeof_size_t == sizeof(uint32_t)) {
-    uint32_t pvalue = read_uint32_t(info);
-    value = (size_t)pvalue;
-    if ((uint32_t)value != pvalue) {
-      eris_error(info, ERIS_ERR_TRUNC_SIZE);
-    }
-  }
-  else if (info->u.upi.sizeof_size_t == sizeof(uint64_t)) {
-    uint64_t pvalue = read_uint64_t(info);
-    value = (size_t)pvalue;
-    if ((uint64_t)value != pvalue) {
-      eris_error(info, ERIS_ERR_TRUNC_SIZE);
-    }
-  }
-  else {
-    eris_error(info, ERIS_ERR_TYPE_SIZE);
-    value = 0; /* not reached */
-  }
-  return value;
+  return info->u.upi.read_size_t(info);
 }
 
 static lua_Number
@@ -782,6 +910,62 @@ read_Instruction(Info *info) {
   return (Instruction)read_uint32_t(info);
 }
 
+static uint64_t
+read_varint(Info *info) {
+  uint64_t value = 0;
+  unsigned int shift;
+  for (shift = 0; shift < 64; shift += 7) {
+    const uint8_t byte = read_uint8_t(info);
+    value |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+  eris_error(info, ERIS_ERR_VARINT);
+  return 0; /* not reached */
+}
+
+static lua_Number
+read_number(Info *info) {
+  if (info->u.upi.compactNumbers) {
+    const uint64_t value = read_varint(info);
+    if (value & 1) {
+      if (value != 1) {
+        eris_error(info, ERIS_ERR_VARINT);
+      }
+      return read_lua_Number(info);
+    }
+    else {
+      const uint64_t zigzag = value >> 1;
+      const int64_t integer = (zigzag & 1) ? (int64_t)~(zigzag >> 1)
+                                           : (int64_t)(zigzag >> 1);
+      return (lua_Number)integer;
+    }
+  }
+  return read_lua_Number(info);
+}
+
+/* Reads the number of elements of an array that is about to be allocated.
+ * Each element takes at least 'size' bytes in the input, so if we know how
+ * much input is left we can reject bogus counts before allocating anything
+ * for them. */
+static size_t
+read_count(Info *info, size_t count, size_t size, const char *what) {
+  if (info->u.upi.wholeInput && count > info->u.upi.zio.n / size) {
+    eris_error(info, ERIS_ERR_SIZE, what);
+  }
+  return count;
+}
+
+static int
+read_intcount(Info *info, size_t size, const char *what) {
+  const int count = READ_VALUE(int);
+  if (count < 0) {
+    eris_error(info, ERIS_ERR_SIZE, what);
+  }
+  return (int)read_count(info, (size_t)count, size, what);
+}
+
 /** ======================================================================== */
 
 /* Forward declarations for recursively called top-level functions. */
@@ -827,13 +1011,13 @@ u_pointer(Info *info) {                                                /* ... */
 
 static void
 p_number(Info *info) {                                             /* ... num */
-  WRITE_VALUE(lua_tonumber(info->L, -1), lua_Number);
+  WRITE_VALUE(lua_tonumber(info->L, -1), number);
 }
 
 static void
 u_number(Info *info) {                                                 /* ... */
   eris_checkstack(info->L, 1);
-  lua_pushnumber(info->L, READ_VALUE(lua_Number));                 /* ... num */
+  lua_pushnumber(info->L, READ_VALUE(number));                     /* ... num */
 
   eris_assert(lua_type(info->L, -1) == LUA_TNUMBER);
 }
@@ -853,7 +1037,7 @@ u_string(Info *info) {                                                 /* ... */
   eris_checkstack(info->L, 2);
   {
     /* TODO Can we avoid this copy somehow? (Without it getting too nasty) */
-    const size_t length = READ_VALUE(size_t);
+    const size_t length = read_count(info, READ_VALUE(size_t), 1, "string");
     char *value = (char*)lua_newuserdata(info->L, length * sizeof(char)); /* ... tmp */
     READ_RAW(value, length);
     lua_pushlstring(info->L, value, length);                   /* ... tmp str */
@@ -998,7 +1182,7 @@ static void
 u_literaluserdata(Info *info) {                                        /* ... */
   eris_checkstack(info->L, 1);
   {
-    size_t size = READ_VALUE(size_t);
+    size_t size = read_count(info, READ_VALUE(size_t), 1, "userdata");
     void *value = lua_newuserdata(info->L, size);                /* ... udata */
     READ_RAW(value, size);                                       /* ... udata */
   }
@@ -1263,14 +1447,18 @@ u_proto(Info *info) {                                            /* ... proto */
   p->is_vararg = READ_VALUE(uint8_t);
   p->maxstacksize = READ_VALUE(uint8_t);
 
-  /* Read byte code. */
-  p->sizecode = READ_VALUE(int);
-  eris_reallocvector(info->L, p->code, 0, p->sizecode, Instruction);
+  /* Read byte code. Sizes are only set after allocating the arrays, so the
+   * GC never sees a size without the matching array should we run out of
+   * memory. */
+  n = read_intcount(info, sizeof(uint32_t), "code");
+  eris_reallocvector(info->L, p->code, 0, n, Instruction);
+  p->sizecode = n;
   READ(p->code, p->sizecode, Instruction);
 
   /* Read constants. */
-  p->sizek = READ_VALUE(int);
-  eris_reallocvector(info->L, p->k, 0, p->sizek, TValue);
+  n = read_intcount(info, 1, "constants");
+  eris_reallocvector(info->L, p->k, 0, n, TValue);
+  p->sizek = n;
   /* Set all values to nil to avoid confusing the GC. */
   for (i = 0, n = p->sizek; i < n; ++i) {
     eris_setnilvalue(&p->k[i]);
@@ -1286,8 +1474,9 @@ u_proto(Info *info) {                                            /* ... proto */
   poppath(info);
 
   /* Read child protos. */
-  p->sizep = READ_VALUE(int);
-  eris_reallocvector(info->L, p->p, 0, p->sizep, Proto*);
+  n = read_intcount(info, 1, "protos");
+  eris_reallocvector(info->L, p->p, 0, n, Proto*);
+  p->sizep = n;
   /* Null all entries to avoid confusing the GC. */
   memset(p->p, 0, p->sizep * sizeof(Proto*));
   pushpath(info, ".protos");
@@ -1308,8 +1497,9 @@ u_proto(Info *info) {                                            /* ... proto */
   poppath(info);
 
   /* Read upvalues. */
-  p->sizeupvalues = READ_VALUE(int);
-  eris_reallocvector(info->L, p->upvalues, 0, p->sizeupvalues, Upvaldesc);
+  n = read_intcount(info, 2, "upvalues");
+  eris_reallocvector(info->L, p->upvalues, 0, n, Upvaldesc);
+  p->sizeupvalues = n;
   for (i = 0, n = p->sizeupvalues; i < n; ++i) {
     p->upvalues[i].name = NULL;
     p->upvalues[i].instack = READ_VALUE(uint8_t);
@@ -1329,13 +1519,15 @@ u_proto(Info *info) {                                            /* ... proto */
   lua_pop(info->L, 1);                                           /* ... proto */
 
   /* Read line information. */
-  p->sizelineinfo = READ_VALUE(int);
-  eris_reallocvector(info->L, p->lineinfo, 0, p->sizelineinfo, int);
+  n = read_intcount(info, sizeof(int16_t), "lineinfo");
+  eris_reallocvector(info->L, p->lineinfo, 0, n, int);
+  p->sizelineinfo = n;
   READ(p->lineinfo, p->sizelineinfo, int);
 
   /* Read locals info. */
-  p->sizelocvars = READ_VALUE(int);
-  eris_reallocvector(info->L, p->locvars, 0, p->sizelocvars, LocVar);
+  n = read_intcount(info, 1, "locvars");
+  eris_reallocvector(info->L, p->locvars, 0, n, LocVar);
+  p->sizelocvars = n;
   /* Null the variable names to avoid confusing the GC. */
   for (i = 0, n = p->sizelocvars; i < n; ++i) {
     p->locvars[i].varname = NULL;
@@ -1836,7 +2028,13 @@ u_thread(Info *info) {                                                 /* ... */
   registerobject(info);
 
   /* Unpersist the stack. Read size first and adjust accordingly. */
-  eris_reallocstack(thread, READ_VALUE(int));
+  {
+    const int stacksize = READ_VALUE(int);
+    if (stacksize <= EXTRA_STACK || stacksize > eris_maxstacksize) {
+      eris_error(info, ERIS_ERR_SIZE, "stack");
+    }
+    eris_reallocstack(thread, stacksize);
+  }
   stack = thread->stack; /* After the realloc in case the address changes. */
   thread->top = thread->stack + READ_VALUE(size_t);
   validate(thread->top, thread->stack_last);
@@ -2129,6 +2327,11 @@ persist_keyed(Info *info, int type) {          /* perms reftbl ... obj refkey */
 
   /* If the object has already been written, write a reference to it. */
   lua_rawget(info->L, REFTIDX);           /* perms reftbl ... obj refkey ref? */
+  if (lua_isnil(info->L, -1) && info->sharedRefs) {
+    lua_pop(info->L, 1);                       /* perms reftbl ... obj refkey */
+    lua_pushvalue(info->L, -1);         /* perms reftbl ... obj refkey refkey */
+    lua_gettable(info->L, REFTIDX);       /* perms reftbl ... obj refkey ref? */
+  }
   if (!lua_isnil(info->L, -1)) {           /* perms reftbl ... obj refkey ref */
     const int reference = lua_tointeger(info->L, -1);
     WRITE_VALUE(reference + ERIS_REFERENCE_OFFSET, int);
@@ -2235,6 +2438,11 @@ unpersist(Info *info) {                                   /* perms reftbl ... */
     if (typeOrReference > ERIS_REFERENCE_OFFSET) {
       const int reference = typeOrReference - ERIS_REFERENCE_OFFSET;
       lua_rawgeti(info->L, REFTIDX, reference);   /* perms reftbl ud ... obj? */
+      if (lua_isnil(info->L, -1) && info->sharedRefs) {
+        lua_pop(info->L, 1);                           /* perms reftbl ud ... */
+        lua_pushinteger(info->L, reference);       /* perms reftbl ud ... ref */
+        lua_gettable(info->L, REFTIDX);           /* perms reftbl ud ... obj? */
+      }
       if (lua_isnil(info->L, -1)) {                 /* perms reftbl ud ... :( */
         eris_error(info, ERIS_ERR_REF, reference);
       }                                            /* perms reftbl ud ... obj */
@@ -2354,6 +2562,168 @@ reader(lua_State *L, void *ud, size_t *sz) {
   return eris_buffer(buff);
 }
 
+/** ======================================================================== */
+
+/* CRC-32C (Castagnoli) for the checksum trailer. Uses the SSE 4.2 crc32
+ * instruction if the CPU has it, slice-by-8 lookup tables otherwise. */
+#define CRC32C_INIT 0xFFFFFFFFu
+
+typedef uint32_t (*Crc32cFunc)(uint32_t crc, const char *data, size_t size);
+
+static uint32_t crc32c_table[8][256];
+static Crc32cFunc crc32c_impl = NULL;
+
+static uint32_t
+crc32c_sw(uint32_t crc, const char *data, size_t size) {
+  const uint8_t *p = (const uint8_t*)data;
+  while (size >= 8) {
+    const uint32_t lo = crc ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+                               ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+    const uint32_t hi = (uint32_t)p[4] | ((uint32_t)p[5] << 8) |
+                        ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 24);
+    crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^
+          crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+          crc32c_table[3][hi & 0xFF] ^ crc32c_table[2][(hi >> 8) & 0xFF] ^
+          crc32c_table[1][(hi >> 16) & 0xFF] ^ crc32c_table[0][hi >> 24];
+    p += 8;
+    size -= 8;
+  }
+  while (size--) {
+    crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#if defined(ERIS_CRC32C_SSE42)
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32c_hw(uint32_t crc, const char *data, size_t size) {
+  const uint8_t *p = (const uint8_t*)data;
+  uint64_t crc64 = crc;
+  while (size >= 8) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    crc64 = _mm_crc32_u64(crc64, value);
+    p += 8;
+    size -= 8;
+  }
+  crc = (uint32_t)crc64;
+  while (size--) {
+    crc = _mm_crc32_u8(crc, *p++);
+  }
+  return crc;
+}
+#endif
+
+static void
+crc32c_select(void) {
+  uint32_t i, j;
+#if defined(ERIS_CRC32C_SSE42)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) {
+    crc32c_impl = crc32c_hw;
+    return;
+  }
+#endif
+  for (i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (j = 0; j < 8; ++j) {
+      crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+    }
+    crc32c_table[0][i] = crc;
+  }
+  for (i = 0; i < 256; ++i) {
+    for (j = 1; j < 8; ++j) {
+      const uint32_t prev = crc32c_table[j - 1][i];
+      crc32c_table[j][i] = (prev >> 8) ^ crc32c_table[0][prev & 0xFF];
+    }
+  }
+  crc32c_impl = crc32c_sw;
+}
+
+/* With threads, every call goes through pthread_once: peeking at the function
+ * pointer first could see it set before the tables it uses are visible. */
+static uint32_t
+crc32c(uint32_t crc, const char *data, size_t size) {
+#if defined(LUA_USE_PTHREAD)
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  pthread_once(&once, crc32c_select);
+#else
+  if (crc32c_impl == NULL) {
+    crc32c_select();
+  }
+#endif
+  return crc32c_impl(crc, data, size);
+}
+
+/* Wraps the writer or reader used for the data after the header to update
+ * the checksum as the data passes through. The reader only adds a chunk once
+ * it was consumed, since the ZIO may not need all of the last one. */
+typedef struct Checksum {
+  lua_Writer writer;
+  lua_Reader reader;
+  void *ud;
+  uint32_t crc;
+  const char *from;
+  const char *to;
+} Checksum;
+
+static int
+checksum_writer(lua_State *L, const void *p, size_t sz, void *ud) {
+  Checksum *cs = (Checksum*)ud;
+  cs->crc = crc32c(cs->crc, (const char*)p, sz);
+  return cs->writer(L, p, sz, cs->ud);
+}
+
+static const char*
+checksum_reader(lua_State *L, void *ud, size_t *sz) {
+  Checksum *cs = (Checksum*)ud;
+  const char *chunk;
+  if (cs->from) {
+    cs->crc = crc32c(cs->crc, cs->from, cs->to - cs->from);
+  }
+  chunk = cs->reader(L, cs->ud, sz);
+  cs->from = chunk;
+  cs->to = chunk ? chunk + *sz : NULL;
+  return chunk;
+}
+
+/** ======================================================================== */
+
+/* Allocator wrapper used to enforce the 'maxmem' setting while unpersisting. */
+typedef struct MemoryBudget {
+  lua_Alloc allocf;
+  void *ud;
+  size_t used;
+  size_t limit;
+  bool exceeded;
+} MemoryBudget;
+
+static void*
+budget_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+  MemoryBudget *budget = (MemoryBudget*)ud;
+  const size_t oldsize = ptr ? osize : 0;
+  void *block;
+  if (nsize > oldsize && nsize - oldsize > budget->limit - budget->used) {
+    /* Lua will run a full GC and try again before giving up. */
+    budget->exceeded = true;
+    return NULL;
+  }
+  block = budget->allocf(budget->ud, ptr, osize, nsize);
+  if (block != NULL || nsize == 0) {
+    if (nsize > oldsize) {
+      budget->used += nsize - oldsize;
+    }
+    else {
+      /* May free memory allocated before we started, so don't underflow. */
+      const size_t freed = oldsize - nsize;
+      budget->used -= freed < budget->used ? freed : budget->used;
+    }
+    budget->exceeded = false;
+  }
+  return block;
+}
+
 /* }======================================================================== */
 
 /*
@@ -2364,17 +2734,28 @@ reader(lua_State *L, void *ud, size_t *sz) {
 
 static void
 p_header(Info *info) {
+  uint8_t flags = 0;
+  if (info->u.pi.compactNumbers) {
+    flags |= FLAG_COMPACT_NUMBERS;
+  }
+  if (info->u.pi.checksum) {
+    flags |= FLAG_CHECKSUM;
+  }
   WRITE_RAW(kHeader, HEADER_LENGTH);
-  WRITE_VALUE(sizeof(lua_Number), uint8_t);
+  WRITE_VALUE(sizeof(lua_Number) | (flags ? HEADER_HAS_FLAGS : 0), uint8_t);
   WRITE_VALUE(kHeaderNumber, lua_Number);
   WRITE_VALUE(sizeof(int), uint8_t);
   WRITE_VALUE(sizeof(size_t), uint8_t);
+  if (flags) {
+    WRITE_VALUE(flags, uint8_t);
+  }
 }
 
 static void
 u_header(Info *info) {
   char header[HEADER_LENGTH];
-  uint8_t number_size;
+  uint8_t number_size, flags = 0;
+  bool has_flags;
   READ_RAW(header, HEADER_LENGTH);
   if (strncmp(kHeader, header, HEADER_LENGTH)) {
     luaL_error(info->L, "invalid data");
@@ -2388,6 +2769,8 @@ u_header(Info *info) {
 
     number_size = READ_VALUE(uint8_t);
   }
+  has_flags = (number_size & HEADER_HAS_FLAGS) != 0;
+  number_size &= ~HEADER_HAS_FLAGS;
   if (number_size != sizeof(lua_Number)) {
     luaL_error(info->L, "incompatible floating point type");
   }
@@ -2395,50 +2778,187 @@ u_header(Info *info) {
   if (READ_VALUE(lua_Number) != kHeaderNumber) {
     luaL_error(info->L, "incompatible floating point representation");
   }
-  info->u.upi.sizeof_int = READ_VALUE(uint8_t);
-  info->u.upi.sizeof_size_t = READ_VALUE(uint8_t);
+  switch (READ_VALUE(uint8_t)) {
+    case sizeof(int16_t):
+      info->u.upi.read_int = read_int_int16;
+      break;
+    case sizeof(int32_t):
+      info->u.upi.read_int = read_int_int32;
+      break;
+    case sizeof(int64_t):
+      info->u.upi.read_int = read_int_int64;
+      break;
+    default:
+      luaL_error(info->L, ERIS_ERR_TYPE_INT);
+  }
+  switch (READ_VALUE(uint8_t)) {
+    case sizeof(uint16_t):
+      info->u.upi.read_size_t = read_size_t_uint16;
+      break;
+    case sizeof(uint32_t):
+      info->u.upi.read_size_t = read_size_t_uint32;
+      break;
+    case sizeof(uint64_t):
+      info->u.upi.read_size_t = read_size_t_uint64;
+      break;
+    default:
+      luaL_error(info->L, ERIS_ERR_TYPE_SIZE);
+  }
+  if (has_flags) {
+    flags = READ_VALUE(uint8_t);
+    if (flags & ~FLAGS_SUPPORTED) {
+      luaL_error(info->L, ERIS_ERR_FLAGS, flags);
+    }
+  }
+  info->u.upi.compactNumbers = (flags & FLAG_COMPACT_NUMBERS) != 0;
+  info->u.upi.checksum = (flags & FLAG_CHECKSUM) != 0;
 }
 
+/* Starts computing the checksum of all data written after the header. */
 static void
-unchecked_persist(lua_State *L, lua_Writer writer, void *ud) {
-  Info info;                                            /* perms buff rootobj */
-  info.L = L;
-  info.level = 0;
-  info.refcount = 0;
-  info.maxComplexity = kMaxComplexity;
-  info.passIOToPersist = kPassIOToPersist;
-  info.generatePath = kGeneratePath;
-  info.u.pi.writer = writer;
-  info.u.pi.ud = ud;
-  info.u.pi.metafield = kPersistKey;
-  info.u.pi.writeDebugInfo = kWriteDebugInformation;
+p_checksum_begin(Info *info, Checksum *cs) {
+  cs->writer = info->u.pi.writer;
+  cs->ud = info->u.pi.ud;
+  cs->crc = CRC32C_INIT;
+  info->u.pi.writer = checksum_writer;
+  info->u.pi.ud = cs;
+}
 
-  eris_checkstack(L, 3);
+static void
+p_checksum_end(Info *info, Checksum *cs) {
+  info->u.pi.writer = cs->writer;
+  info->u.pi.ud = cs->ud;
+  WRITE_VALUE(~cs->crc, uint32_t);
+}
+
+/* If we have all input we verify the checksum right away, so we never start
+ * decoding corrupted data. Otherwise we compute it while reading. */
+static void
+u_checksum_begin(Info *info, Checksum *cs) {
+  ZIO *zio = &info->u.upi.zio;
+  cs->crc = CRC32C_INIT;
+  if (info->u.upi.wholeInput) {
+    uint32_t expected;
+    if (zio->n < sizeof(uint32_t)) {
+      eris_error(info, ERIS_ERR_CHECKSUM);
+    }
+    expected = decode_uint32_t(zio->p + zio->n - sizeof(uint32_t));
+    if (~crc32c(cs->crc, zio->p, zio->n - sizeof(uint32_t)) != expected) {
+      eris_error(info, ERIS_ERR_CHECKSUM);
+    }
+    return;
+  }
+  cs->reader = zio->reader;
+  cs->ud = zio->data;
+  cs->from = zio->p;
+  cs->to = zio->p + zio->n;
+  zio->reader = checksum_reader;
+  zio->data = cs;
+}
+
+static void
+u_checksum_end(Info *info, Checksum *cs) {
+  ZIO *zio = &info->u.upi.zio;
+  if (info->u.upi.wholeInput) {
+    READ_VALUE(uint32_t); /* Already verified. */
+    return;
+  }
+  if (cs->from) {
+    cs->crc = crc32c(cs->crc, cs->from, zio->p - cs->from);
+  }
+  zio->reader = cs->reader;
+  zio->data = cs->ud;
+  if (~cs->crc != READ_VALUE(uint32_t)) {
+    eris_error(info, ERIS_ERR_CHECKSUM);
+  }
+}
+
+/* Initializes the info for persisting from the current settings. */
+static void
+init_persist(lua_State *L, Info *info, lua_Writer writer, void *ud) {  /* ... */
+  info->L = L;
+  info->level = 0;
+  info->refcount = 0;
+  info->maxComplexity = kMaxComplexity;
+  info->passIOToPersist = kPassIOToPersist;
+  info->generatePath = kGeneratePath;
+  info->sharedRefs = false;
+  info->u.pi.writer = writer;
+  info->u.pi.ud = ud;
+  info->u.pi.metafield = kPersistKey;
+  info->u.pi.writeDebugInfo = kWriteDebugInformation;
+  info->u.pi.compactNumbers = kCompactNumbers;
+  info->u.pi.checksum = kChecksum;
+
+  eris_checkstack(L, 1);
 
-  if (get_setting(L, (void*)&kSettingMaxComplexity)) {
-                                                  /* perms buff rootobj value */
-    info.maxComplexity = lua_tounsigned(L, -1);
-    lua_pop(L, 1);                                      /* perms buff rootobj */
+  if (get_setting(L, (void*)&kSettingMaxComplexity)) {           /* ... value */
+    info->maxComplexity = lua_tounsigned(L, -1);
+    lua_pop(L, 1);                                                     /* ... */
+  }
+  if (get_setting(L, (void*)&kSettingGeneratePath)) {            /* ... value */
+    info->generatePath = lua_toboolean(L, -1);
+    lua_pop(L, 1);                                                     /* ... */
+  }
+  if (get_setting(L, (void*)&kSettingPassIOToPersist)) {         /* ... value */
+    info->passIOToPersist = lua_toboolean(L, -1);
+    lua_pop(L, 1);                                                     /* ... */
+  }
+  if (get_setting(L, (void*)&kSettingMetafield)) {               /* ... value */
+    info->u.pi.metafield = lua_tostring(L, -1);
+    lua_pop(L, 1);                                                     /* ... */
+  }
+  if (get_setting(L, (void*)&kSettingWriteDebugInfo)) {          /* ... value */
+    info->u.pi.writeDebugInfo = lua_toboolean(L, -1);
+    lua_pop(L, 1);                                                     /* ... */
+  }
+  if (get_setting(L, (void*)&kSettingCompactNumbers)) {          /* ... value */
+    info->u.pi.compactNumbers = lua_toboolean(L, -1);
+    lua_pop(L, 1);                                                     /* ... */
   }
-  if (get_setting(L, (void*)&kSettingGeneratePath)) {
-                                                  /* perms buff rootobj value */
-    info.generatePath = lua_toboolean(L, -1);
-    lua_pop(L, 1);                                      /* perms buff rootobj */
+  if (get_setting(L, (void*)&kSettingChecksum)) {                /* ... value */
+    info->u.pi.checksum = lua_toboolean(L, -1);
+    lua_pop(L, 1);                                                     /* ... */
   }
-  if (get_setting(L, (void*)&kSettingPassIOToPersist)) {
-                                                  /* perms buff rootobj value */
-    info.passIOToPersist = lua_toboolean(L, -1);
-    lua_pop(L, 1);                                      /* perms buff rootobj */
+}
+
+/* Initializes the info for unpersisting from the current settings. */
+static void
+init_unpersist(lua_State *L, Info *info, lua_Reader reader, void *ud,
+               bool wholeInput) {                                      /* ... */
+  info->L = L;
+  info->level = 0;
+  info->refcount = 0;
+  info->maxComplexity = kMaxComplexity;
+  info->generatePath = kGeneratePath;
+  info->passIOToPersist = kPassIOToPersist;
+  info->sharedRefs = false;
+  info->u.upi.wholeInput = wholeInput;
+  eris_init(L, &info->u.upi.zio, reader, ud);
+
+  eris_checkstack(L, 1);
+
+  if (get_setting(L, (void*)&kSettingMaxComplexity)) {           /* ... value */
+    info->maxComplexity = lua_tounsigned(L, -1);
+    lua_pop(L, 1);                                                     /* ... */
   }
-  if (get_setting(L, (void*)&kSettingMetafield)) {/* perms buff rootobj value */
-    info.u.pi.metafield = lua_tostring(L, -1);
-    lua_pop(L, 1);                                      /* perms buff rootobj */
+  if (get_setting(L, (void*)&kSettingGeneratePath)) {            /* ... value */
+    info->generatePath = lua_toboolean(L, -1);
+    lua_pop(L, 1);                                                     /* ... */
   }
-  if (get_setting(L, (void*)&kSettingWriteDebugInfo)) {
-                                                  /* perms buff rootobj value */
-    info.u.pi.writeDebugInfo = lua_toboolean(L, -1);
-    lua_pop(L, 1);                                      /* perms buff rootobj */
+  if (get_setting(L, (void*)&kSettingPassIOToPersist)) {         /* ... value */
+    info->passIOToPersist = lua_toboolean(L, -1);
+    lua_pop(L, 1);                                                     /* ... */
   }
+}
+
+static void
+unchecked_persist(lua_State *L, lua_Writer writer, void *ud) {
+  Info info;                                            /* perms buff rootobj */
+  Checksum checksum;
+  init_persist(L, &info, writer, ud);
+
+  eris_checkstack(L, 2);
 
   lua_newtable(L);                               /* perms buff rootobj reftbl */
   lua_insert(L, REFTIDX);                        /* perms reftbl buff rootobj */
@@ -2454,7 +2974,13 @@ unchecked_persist(lua_State *L, lua_Writer writer, void *ud) {
   lua_pop(L, 1);                           /* perms reftbl buff path? rootobj */
 
   p_header(&info);
+  if (info.u.pi.checksum) {
+    p_checksum_begin(&info, &checksum);
+  }
   persist(&info);                          /* perms reftbl buff path? rootobj */
+  if (info.u.pi.checksum) {
+    p_checksum_end(&info, &checksum);
+  }
 
   if (info.generatePath) {                  /* perms reftbl buff path rootobj */
     lua_remove(L, PATHIDX);                      /* perms reftbl buff rootobj */
@@ -2463,32 +2989,13 @@ unchecked_persist(lua_State *L, lua_Writer writer, void *ud) {
 }
 
 static void
-unchecked_unpersist(lua_State *L, lua_Reader reader, void *ud) {/* perms str? */
+do_unpersist(lua_State *L, lua_Reader reader, void *ud,        /* perms str? */
+             bool wholeInput) {
   Info info;
-  info.L = L;
-  info.level = 0;
-  info.refcount = 0;
-  info.maxComplexity = kMaxComplexity;
-  info.generatePath = kGeneratePath;
-  info.passIOToPersist = kPassIOToPersist;
-  eris_init(L, &info.u.upi.zio, reader, ud);
+  Checksum checksum;
+  init_unpersist(L, &info, reader, ud, wholeInput);
 
-  eris_checkstack(L, 3);
-
-  if (get_setting(L, (void*)&kSettingMaxComplexity)) {
-                                                  /* perms buff rootobj value */
-    info.maxComplexity = lua_tounsigned(L, -1);
-    lua_pop(L, 1);                                      /* perms buff rootobj */
-  }
-  if (get_setting(L, (void*)&kSettingGeneratePath)) {
-                                                 /* perms buff? rootobj value */
-    info.generatePath = lua_toboolean(L, -1);
-    lua_pop(L, 1);                                     /* perms buff? rootobj */
-  }
-  if (get_setting(L, (void*)&kSettingPassIOToPersist)) {  /* perms str? value */
-    info.passIOToPersist = lua_toboolean(L, -1);
-    lua_pop(L, 1);                                              /* perms str? */
-  }
+  eris_checkstack(L, 2);
 
   lua_newtable(L);                                       /* perms str? reftbl */
   lua_insert(L, REFTIDX);                                /* perms reftbl str? */
@@ -2508,7 +3015,13 @@ unchecked_unpersist(lua_State *L, lua_Reader reader, void *ud) {/* perms str? */
   lua_pop(L, 1);                              /* perms reftbl nil? path? str? */
 
   u_header(&info);
+  if (info.u.upi.checksum) {
+    u_checksum_begin(&info, &checksum);
+  }
   unpersist(&info);                   /* perms reftbl nil? path? str? rootobj */
+  if (info.u.upi.checksum) {
+    u_checksum_end(&info, &checksum);
+  }
   if (info.generatePath) {              /* perms reftbl nil path str? rootobj */
     lua_remove(L, PATHIDX);                  /* perms reftbl nil str? rootobj */
     lua_remove(L, BUFFIDX);                      /* perms reftbl str? rootobj */
@@ -2516,6 +3029,70 @@ unchecked_unpersist(lua_State *L, lua_Reader reader, void *ud) {/* perms str? */
   lua_remove(L, REFTIDX);                               /* perms str? rootobj */
 }
 
+typedef struct UnpersistCall {
+  lua_Reader reader;
+  void *ud;
+  bool wholeInput;
+} UnpersistCall;
+
+static void
+protected_unpersist(lua_State *L, void *ud) {                  /* perms str? */
+  UnpersistCall *call = (UnpersistCall*)ud;
+  do_unpersist(L, call->reader, call->ud, call->wholeInput);
+}
+
+/* Runs an unpersist operation, enforcing the 'maxmem' setting. */
+static void
+budgeted_unpersist(lua_State *L, Pfunc f, void *ud) {                  /* ... */
+  lua_Unsigned maxMemory = kMaxMemory;
+
+  eris_checkstack(L, 1);
+
+  if (get_setting(L, (void*)&kSettingMaxMemory)) {               /* ... value */
+    maxMemory = lua_tounsigned(L, -1);
+    lua_pop(L, 1);                                                     /* ... */
+  }
+
+  if (maxMemory == 0) {
+    f(L, ud);                                                   /* ... result */
+  }
+  else {
+    /* Swap in an allocator that fails once we exceed the limit, and run the
+     * actual unpersisting in protected mode so that we can restore the
+     * original allocator no matter how it ends. */
+    MemoryBudget budget;
+    int status;
+    budget.allocf = lua_getallocf(L, &budget.ud);
+    budget.used = 0;
+    budget.limit = maxMemory;
+    budget.exceeded = false;
+    lua_setallocf(L, budget_alloc, &budget);
+    status = eris_pcall(L, f, ud, eris_savestack(L, L->top), 0);
+    lua_setallocf(L, budget.allocf, budget.ud);
+    if (status == LUA_ERRMEM && budget.exceeded) {
+      luaL_error(L, ERIS_ERR_MAXMEM, (lua_Number)maxMemory);
+    }
+    else if (status == LUA_ERRMEM) {
+      eris_throw(L, status);
+    }
+    else if (status != LUA_OK) {                                   /* ... err */
+      lua_error(L);
+    }                                                           /* ... result */
+  }
+}
+
+/* If 'wholeInput' is set the reader must return all data in its first call,
+ * which allows validating sizes read from the data against its length. */
+static void
+unchecked_unpersist(lua_State *L, lua_Reader reader, void *ud,/* perms str? */
+                    bool wholeInput) {
+  UnpersistCall call;
+  call.reader = reader;
+  call.ud = ud;
+  call.wholeInput = wholeInput;
+  budgeted_unpersist(L, protected_unpersist, &call);  /* perms str? rootobj */
+}
+
 /** ======================================================================== */
 
 static int
@@ -2575,29 +3152,441 @@ l_unpersist(lua_State *L) {                               /* perms? str? ...? */
   eris_sizebuffer(&buff) = eris_bufflen(&buff);             /* perms str ...? */
   lua_settop(L, 2);                                              /* perms str */
 
-  unchecked_unpersist(L, reader, &buff);                 /* perms str rootobj */
+  unchecked_unpersist(L, reader, &buff, true);           /* perms str rootobj */
 
   return 1;
 }
 
-#define IS(s) strncmp(s, name, length < sizeof(s) ? length : sizeof(s)) == 0
+/** ======================================================================== */
+
+/* Persisting many values that share objects, e.g. coroutines running the same
+ * scripts. All objects reachable from more than one of the values are written
+ * to a shared section after the header, followed by one section per value.
+ * Each value's section starts out with the references of the shared section,
+ * so it can be read on its own once the shared section has been read. The
+ * data ends with a footer to find the sections:
+ *   uint64_t offsets[count]; -- start of each value's section
+ *   uint32_t sharedRefs;     -- number of references in the shared section
+ *   uint32_t count;
+ *   char magic[4] = "ERSM";
+ * Like everything else, the numbers are stored little endian.
+ */
+static char const kManyFooter[] = { 'E', 'R', 'S', 'M' };
+#define MANY_FOOTER_SIZE (2 * sizeof(uint32_t) + sizeof(kManyFooter))
+
+/* Registry key of the last shared section read by unpersist_one. */
+static const char *const kManyCache = "manycache";
+
+/* Indices into the shared section cache entry. */
+#define MANYDATA 1
+#define MANYPERMS 2
+#define MANYREFTBL 3
+#define MANYROOT 4
 
 static int
-l_settings(lua_State *L) {                                /* name value? ...? */
-  size_t length;
-  const char *name = luaL_checklstring(L, 1, &length);
-  if (lua_isnone(L, 2)) {                                        /* name ...? */
-    lua_settop(L, 1);                                                 /* name */
-    /* Get the current setting value and return it. */
-    if (IS(kSettingMetafield)) {
-      if (!get_setting(L, (void*)&kSettingMetafield)) {
-        lua_pushstring(L, kPersistKey);
-      }
-    }
-    else if (IS(kSettingPassIOToPersist)) {
-      if (!get_setting(L, (void*)&kSettingPassIOToPersist)) {
-        lua_pushboolean(L, kPassIOToPersist);
-      }
+null_writer(lua_State *L, const void *p, size_t sz, void *ud) {
+  (void) L; (void) p; (void) sz; (void) ud; /* unused */
+  return 0;
+}
+
+/* Increments the count for the object on top of the stack. */
+static void
+count_object(lua_State *L, int counts) {                           /* ... obj */
+  lua_Integer count;
+  lua_pushvalue(L, -1);                                        /* ... obj obj */
+  lua_rawget(L, counts);                                    /* ... obj count? */
+  count = lua_tointeger(L, -1);
+  lua_pop(L, 1);                                                   /* ... obj */
+  lua_pushvalue(L, -1);                                        /* ... obj obj */
+  lua_pushinteger(L, count + 1);                         /* ... obj obj count */
+  lua_rawset(L, counts);                                           /* ... obj */
+}
+
+/* Creates a closure for a proto, so that we can put it in the shared list.
+ * The upvalues are all nil, we only keep the closure to anchor the proto. */
+static void
+push_protoclosure(lua_State *L, Proto *p) {                            /* ... */
+  int i;
+  Closure *cl = eris_newLclosure(L, p->sizeupvalues);
+  cl->l.p = p;
+  eris_setclLvalue(L, L->top, cl);                                 /* ... lcl */
+  eris_incr_top(L);
+  for (i = 0; i < p->sizeupvalues; ++i) {
+    cl->l.upvals[i] = eris_newupval(L);
+    luaC_objbarrier(L, cl, cl->l.upvals[i]);
+  }
+}
+
+/* Persists each value on its own without output, and counts in how many of
+ * them each object is referenced. The protos of Lua closures are counted
+ * separately, since closures are usually per value while the code they run
+ * is shared. Pushes a list of the objects that are shared. */
+static void
+p_shared(Info *info, int list, int n) {            /* perms reftbl buff ... */
+  lua_State *L = info->L;
+  int counts, i, k = 0;
+
+  eris_checkstack(L, 5);
+  lua_newtable(L);                                 /* perms reftbl ... counts */
+  counts = lua_gettop(L);
+  for (i = 1; i <= n; ++i) {
+    lua_newtable(L);                         /* perms reftbl ... counts reftbl */
+    lua_replace(L, REFTIDX);                        /* perms reftbl ... counts */
+    info->level = 0;
+    info->refcount = 0;
+    pushpath(info, "[%d]", i);
+    lua_rawgeti(L, list, i);                    /* perms reftbl ... counts obj */
+    persist(info);                              /* perms reftbl ... counts obj */
+    lua_pop(L, 1);                                  /* perms reftbl ... counts */
+    poppath(info);
+
+    lua_newtable(L);                         /* perms reftbl ... counts protos */
+    lua_pushnil(L);                      /* perms reftbl ... counts protos nil */
+    while (lua_next(L, REFTIDX)) {   /* perms reftbl ... counts protos obj ref */
+      lua_pop(L, 1);                     /* perms reftbl ... counts protos obj */
+      /* Light userdata keys are protos and upvalues, skip them. */
+      if (lua_type(L, -1) != LUA_TLIGHTUSERDATA) {
+        count_object(L, counts);         /* perms reftbl ... counts protos obj */
+      }
+      if (lua_type(L, -1) == LUA_TFUNCTION && !lua_iscfunction(L, -1)) {
+        lua_pushlightuserdata(L, eris_clLvalue(L->top - 1)->p);
+                                    /* perms reftbl ... counts protos obj proto */
+        lua_pushvalue(L, -1);
+                              /* perms reftbl ... counts protos obj proto proto */
+        lua_rawget(L, -4);   /* perms reftbl ... counts protos obj proto seen? */
+        if (lua_isnil(L, -1)) {
+          lua_pop(L, 1);            /* perms reftbl ... counts protos obj proto */
+          count_object(L, counts);  /* perms reftbl ... counts protos obj proto */
+          lua_pushboolean(L, true);
+                               /* perms reftbl ... counts protos obj proto true */
+          lua_rawset(L, -4);              /* perms reftbl ... counts protos obj */
+        }
+        else {
+          lua_pop(L, 2);                  /* perms reftbl ... counts protos obj */
+        }
+      }
+    }                                        /* perms reftbl ... counts protos */
+    lua_pop(L, 1);                                  /* perms reftbl ... counts */
+  }
+
+  lua_newtable(L);                          /* perms reftbl ... counts shared */
+  lua_pushnil(L);                       /* perms reftbl ... counts shared nil */
+  while (lua_next(L, counts)) {   /* perms reftbl ... counts shared obj count */
+    if (lua_tointeger(L, -1) > 1) {
+      switch (lua_type(L, -2)) {
+        case LUA_TLIGHTUSERDATA:
+          push_protoclosure(L, (Proto*)lua_touserdata(L, -2));
+                              /* perms reftbl ... counts shared obj count lcl */
+          lua_rawseti(L, -4, ++k);    /* perms reftbl ... counts shared obj count */
+          break;
+        case LUA_TSTRING:
+        case LUA_TTABLE:
+        case LUA_TFUNCTION:
+        case LUA_TUSERDATA:
+          lua_pushvalue(L, -2);
+                              /* perms reftbl ... counts shared obj count obj */
+          lua_rawseti(L, -4, ++k);    /* perms reftbl ... counts shared obj count */
+          break;
+        default:
+          /* Threads stay with the values, like upvalues. */
+          break;
+      }
+    }
+    lua_pop(L, 1);                       /* perms reftbl ... counts shared obj */
+  }                                         /* perms reftbl ... counts shared */
+  lua_remove(L, counts);                            /* perms reftbl ... shared */
+}
+
+static void
+p_manyfooter(Info *info, const uint64_t *offsets, uint32_t count,
+             uint32_t sharedRefs) {
+  uint32_t i;
+  for (i = 0; i < count; ++i) {
+    write_uint64_t(info, offsets[i]);
+  }
+  write_uint32_t(info, sharedRefs);
+  write_uint32_t(info, count);
+  WRITE_RAW(kManyFooter, sizeof(kManyFooter));
+}
+
+static int
+l_persist_many(lua_State *L) {                            /* perms? list ...? */
+  Info info;
+  Mbuffer buff;
+  uint64_t *offsets;
+  uint32_t sharedRefs;
+  int list, shared, mt, n, i;
+
+  if (lua_isnil(L, 1)) {
+    lua_newtable(L);                                      /* nil list ...? perms */
+    lua_replace(L, 1);                                        /* perms list ...? */
+  }
+  luaL_checktype(L, 1, LUA_TTABLE);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  lua_settop(L, 2);                                               /* perms list */
+  n = (int)lua_rawlen(L, 2);
+
+  eris_initbuffer(L, &buff);
+  eris_bufflen(&buff) = 0; /* Not initialized by initbuffer... */
+  init_persist(L, &info, null_writer, NULL);
+  /* Sections are read individually, so there is nothing to verify against. */
+  info.u.pi.checksum = false;
+
+  eris_checkstack(L, 6);
+  lua_pushnil(L);                                             /* perms list buff */
+  lua_insert(L, 2);                                           /* perms buff list */
+  lua_newtable(L);                                     /* perms buff list reftbl */
+  lua_insert(L, REFTIDX);                              /* perms reftbl buff list */
+  if (info.generatePath) {
+    lua_newtable(L);                              /* perms reftbl buff list path */
+    lua_insert(L, PATHIDX);                       /* perms reftbl buff path list */
+    pushpath(&info, "root");
+  }
+  list = lua_gettop(L);
+
+  /* Populate perms table with Lua internals. */
+  lua_pushvalue(L, PERMIDX);                /* perms reftbl buff path? list perms */
+  populateperms(L, false);
+  lua_pop(L, 1);                                  /* perms reftbl buff path? list */
+
+  p_shared(&info, list, n);                /* perms reftbl buff path? list shared */
+
+  /* Now for real. Write the shared section, keep its reference table. */
+  info.u.pi.writer = writer;
+  info.u.pi.ud = &buff;
+  info.level = 0;
+  info.refcount = 0;
+  lua_newtable(L);                  /* perms reftbl buff path? list shared reftbl */
+  lua_replace(L, REFTIDX);                 /* perms reftbl buff path? list shared */
+  p_header(&info);
+  pushpath(&info, ".shared");
+  persist(&info);                          /* perms reftbl buff path? list shared */
+  poppath(&info);
+  sharedRefs = (uint32_t)info.refcount;
+  lua_pushvalue(L, REFTIDX);          /* perms reftbl buff path? list shared srefs */
+  lua_replace(L, list + 1);                 /* perms reftbl buff path? list srefs */
+  shared = list + 1;
+  lua_createtable(L, 0, 1);              /* perms reftbl buff path? list srefs mt */
+  lua_pushvalue(L, shared);        /* perms reftbl buff path? list srefs mt srefs */
+  lua_setfield(L, -2, "__index");        /* perms reftbl buff path? list srefs mt */
+  mt = lua_gettop(L);
+  offsets = (uint64_t*)lua_newuserdata(L, (n ? n : 1) * sizeof(uint64_t));
+                                   /* perms reftbl buff path? list srefs mt offs */
+
+  /* Write each value's section, starting with the shared references. */
+  info.sharedRefs = true;
+  for (i = 1; i <= n; ++i) {
+    offsets[i - 1] = (uint64_t)eris_bufflen(&buff);
+    lua_newtable(L);          /* perms reftbl buff path? list srefs mt offs reftbl */
+    lua_pushvalue(L, mt);  /* perms reftbl buff path? list srefs mt offs reftbl mt */
+    lua_setmetatable(L, -2);
+                              /* perms reftbl buff path? list srefs mt offs reftbl */
+    lua_replace(L, REFTIDX);         /* perms reftbl buff path? list srefs mt offs */
+    info.level = 0;
+    info.refcount = (int)sharedRefs;
+    pushpath(&info, "[%d]", i);
+    lua_rawgeti(L, list, i);     /* perms reftbl buff path? list srefs mt offs obj */
+    persist(&info);              /* perms reftbl buff path? list srefs mt offs obj */
+    lua_pop(L, 1);                   /* perms reftbl buff path? list srefs mt offs */
+    poppath(&info);
+  }
+
+  p_manyfooter(&info, offsets, (uint32_t)n, sharedRefs);
+
+  lua_pushlstring(L, eris_buffer(&buff), eris_bufflen(&buff));
+                               /* perms reftbl buff path? list srefs mt offs str */
+  return 1;
+}
+
+/* The sections of one value in data written by persist_many. */
+typedef struct ManySection {
+  const char *data;
+  size_t sharedEnd;
+  size_t begin;
+  size_t end;
+  uint32_t sharedRefs;
+} ManySection;
+
+static void
+protected_unpersist_one(lua_State *L, void *ud) {                /* perms str */
+  ManySection *section = (ManySection*)ud;
+  Info info;
+  RBuffer buff;
+  size_t length;
+  const char *data = lua_tolstring(L, 2, &length);
+  bool cached = false;
+
+  eris_buffer(&buff) = section->data;
+  eris_bufflen(&buff) = section->sharedEnd;
+  eris_sizebuffer(&buff) = section->sharedEnd;
+  init_unpersist(L, &info, reader, &buff, true);
+
+  eris_checkstack(L, 4);
+
+  /* See if we have read the shared section of this data before. */
+  lua_rawgetp(L, LUA_REGISTRYINDEX, &kManyCache);            /* perms str cache? */
+  if (lua_istable(L, -1)) {                                   /* perms str cache */
+    lua_rawgeti(L, -1, MANYDATA);                         /* perms str cache data */
+    lua_rawgeti(L, -2, MANYPERMS);                  /* perms str cache data perms */
+    cached = lua_tostring(L, -2) == data && lua_rawequal(L, -1, PERMIDX);
+    lua_pop(L, 2);                                            /* perms str cache */
+  }
+  lua_pop(L, 1);                                                    /* perms str */
+
+  lua_newtable(L);                                           /* perms str reftbl */
+  lua_insert(L, REFTIDX);                                    /* perms reftbl str */
+  if (info.generatePath) {
+    lua_pushnil(L);                                      /* perms reftbl str nil */
+    lua_insert(L, BUFFIDX);                              /* perms reftbl nil str */
+    lua_newtable(L);                                /* perms reftbl nil str path */
+    lua_insert(L, PATHIDX);                         /* perms reftbl nil path str */
+    pushpath(&info, "root");
+  }
+
+  lua_pushvalue(L, PERMIDX);                /* perms reftbl nil? path? str perms */
+  populateperms(L, true);
+  lua_pop(L, 1);                                  /* perms reftbl nil? path? str */
+
+  u_header(&info);
+  if (!cached) {
+    pushpath(&info, ".shared");
+    unpersist(&info);                      /* perms reftbl nil? path? str shared */
+    poppath(&info);
+    if (info.refcount != (int)section->sharedRefs) {
+      eris_error(&info, ERIS_ERR_MANY);
+    }
+    lua_createtable(L, 4, 0);        /* perms reftbl nil? path? str shared cache */
+    lua_pushvalue(L, -3);        /* perms reftbl nil? path? str shared cache str */
+    lua_rawseti(L, -2, MANYDATA);    /* perms reftbl nil? path? str shared cache */
+    lua_pushvalue(L, PERMIDX); /* perms reftbl nil? path? str shared cache perms */
+    lua_rawseti(L, -2, MANYPERMS);   /* perms reftbl nil? path? str shared cache */
+    lua_pushvalue(L, REFTIDX);
+                              /* perms reftbl nil? path? str shared cache reftbl */
+    lua_rawseti(L, -2, MANYREFTBL);  /* perms reftbl nil? path? str shared cache */
+    lua_insert(L, -2);               /* perms reftbl nil? path? str cache shared */
+    lua_rawseti(L, -2, MANYROOT);           /* perms reftbl nil? path? str cache */
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &kManyCache);
+                                                  /* perms reftbl nil? path? str */
+  }
+
+  /* Read the value's section, starting with the shared references. */
+  lua_newtable(L);                         /* perms reftbl nil? path? str reftbl */
+  lua_createtable(L, 0, 1);             /* perms reftbl nil? path? str reftbl mt */
+  lua_rawgetp(L, LUA_REGISTRYINDEX, &kManyCache);
+                                  /* perms reftbl nil? path? str reftbl mt cache */
+  lua_rawgeti(L, -1, MANYREFTBL);
+                            /* perms reftbl nil? path? str reftbl mt cache srefs */
+  lua_setfield(L, -3, "__index");
+                                  /* perms reftbl nil? path? str reftbl mt cache */
+  lua_pop(L, 1);                        /* perms reftbl nil? path? str reftbl mt */
+  lua_setmetatable(L, -2);                 /* perms reftbl nil? path? str reftbl */
+  lua_replace(L, REFTIDX);                        /* perms reftbl nil? path? str */
+
+  eris_buffer(&buff) = section->data + section->begin;
+  eris_bufflen(&buff) = section->end - section->begin;
+  eris_sizebuffer(&buff) = eris_bufflen(&buff);
+  eris_init(L, &info.u.upi.zio, reader, &buff);
+  info.level = 0;
+  info.refcount = (int)section->sharedRefs;
+  info.sharedRefs = true;
+  unpersist(&info);                       /* perms reftbl nil? path? str rootobj */
+
+  if (info.generatePath) {                  /* perms reftbl nil path str rootobj */
+    lua_remove(L, PATHIDX);                      /* perms reftbl nil str rootobj */
+    lua_remove(L, BUFFIDX);                          /* perms reftbl str rootobj */
+  }                                                  /* perms reftbl str rootobj */
+  lua_remove(L, REFTIDX);                                   /* perms str rootobj */
+}
+
+static uint32_t
+many_uint32(const char *data) {
+  return decode_uint32_t(data);
+}
+
+static size_t
+many_offset(const char *index, size_t i) {
+  return (size_t)decode_uint64_t(index + i * sizeof(uint64_t));
+}
+
+static int
+l_unpersist_one(lua_State *L) {                        /* perms? str index ...? */
+  ManySection section;
+  size_t length, indexStart, count;
+  lua_Integer index;
+
+  if (lua_gettop(L) == 2) {                                       /* str index */
+    /* Without perms, reuse the (empty) ones we read the cached shared section
+     * with, if it's for the same data, so we can use the cache. */
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &kManyCache);      /* str index cache? */
+    if (lua_istable(L, -1)) {                              /* str index cache */
+      lua_rawgeti(L, -1, MANYDATA);                   /* str index cache data */
+      if (lua_tostring(L, -1) == lua_tostring(L, 1)) {
+        lua_rawgeti(L, -2, MANYPERMS);          /* str index cache data perms */
+      }
+      else {
+        lua_newtable(L);                        /* str index cache data perms */
+      }
+      lua_replace(L, -3);                            /* str index perms data */
+      lua_pop(L, 1);                                      /* str index perms */
+    }
+    else {                                                  /* str index nil */
+      lua_pop(L, 1);                                            /* str index */
+      lua_newtable(L);                                      /* str index perms */
+    }
+    lua_insert(L, PERMIDX);                                 /* perms str index */
+  }
+  luaL_checktype(L, 1, LUA_TTABLE);
+  section.data = luaL_checklstring(L, 2, &length);
+  index = luaL_checkinteger(L, 3);
+  lua_settop(L, 2);                                                /* perms str */
+
+  /* Find the sections via the footer, making sure everything is in bounds. */
+  if (length < MANY_FOOTER_SIZE ||
+      memcmp(section.data + length - sizeof(kManyFooter), kManyFooter,
+             sizeof(kManyFooter))) {
+    return luaL_error(L, ERIS_ERR_MANY);
+  }
+  count = many_uint32(section.data + length - sizeof(kManyFooter) -
+                      sizeof(uint32_t));
+  section.sharedRefs = many_uint32(section.data + length - MANY_FOOTER_SIZE);
+  if (count > (length - MANY_FOOTER_SIZE) / sizeof(uint64_t)) {
+    return luaL_error(L, ERIS_ERR_MANY);
+  }
+  indexStart = length - MANY_FOOTER_SIZE - count * sizeof(uint64_t);
+  luaL_argcheck(L, index >= 1 && (size_t)index <= count, 3,
+                "index out of bounds");
+  section.sharedEnd = many_offset(section.data + indexStart, 0);
+  section.begin = many_offset(section.data + indexStart, (size_t)index - 1);
+  section.end = (size_t)index < count ?
+    many_offset(section.data + indexStart, (size_t)index) : indexStart;
+  if (section.sharedEnd > section.begin || section.begin > section.end ||
+      section.end > indexStart || section.sharedRefs > INT_MAX) {
+    return luaL_error(L, ERIS_ERR_MANY);
+  }
+
+  budgeted_unpersist(L, protected_unpersist_one, &section);
+                                                           /* perms str rootobj */
+  return 1;
+}
+
+#define IS(s) strncmp(s, name, length < sizeof(s) ? length : sizeof(s)) == 0
+
+static int
+l_settings(lua_State *L) {                                /* name value? ...? */
+  size_t length;
+  const char *name = luaL_checklstring(L, 1, &length);
+  if (lua_isnone(L, 2)) {                                        /* name ...? */
+    lua_settop(L, 1);                                                 /* name */
+    /* Get the current setting value and return it. */
+    if (IS(kSettingMetafield)) {
+      if (!get_setting(L, (void*)&kSettingMetafield)) {
+        lua_pushstring(L, kPersistKey);
+      }
+    }
+    else if (IS(kSettingPassIOToPersist)) {
+      if (!get_setting(L, (void*)&kSettingPassIOToPersist)) {
+        lua_pushboolean(L, kPassIOToPersist);
+      }
     }
     else if (IS(kSettingWriteDebugInfo)) {
       if (!get_setting(L, (void*)&kSettingWriteDebugInfo)) {
@@ -2614,6 +3603,21 @@ l_settings(lua_State *L) {                                /* name value? ...? */
         lua_pushunsigned(L, kMaxComplexity);
       }
     }
+    else if (IS(kSettingCompactNumbers)) {
+      if (!get_setting(L, (void*)&kSettingCompactNumbers)) {
+        lua_pushboolean(L, kCompactNumbers);
+      }
+    }
+    else if (IS(kSettingMaxMemory)) {
+      if (!get_setting(L, (void*)&kSettingMaxMemory)) {
+        lua_pushunsigned(L, kMaxMemory);
+      }
+    }
+    else if (IS(kSettingChecksum)) {
+      if (!get_setting(L, (void*)&kSettingChecksum)) {
+        lua_pushboolean(L, kChecksum);
+      }
+    }
     else {
       return luaL_argerror(L, 1, "no such setting");
     }                                                           /* name value */
@@ -2642,6 +3646,18 @@ l_settings(lua_State *L) {                                /* name value? ...? */
       luaL_optunsigned(L, 2, 0);
       set_setting(L, (void*)&kSettingMaxComplexity);
     }
+    else if (IS(kSettingCompactNumbers)) {
+      luaL_opt(L, checkboolean, 2, false);
+      set_setting(L, (void*)&kSettingCompactNumbers);
+    }
+    else if (IS(kSettingMaxMemory)) {
+      luaL_optunsigned(L, 2, 0);
+      set_setting(L, (void*)&kSettingMaxMemory);
+    }
+    else if (IS(kSettingChecksum)) {
+      luaL_opt(L, checkboolean, 2, false);
+      set_setting(L, (void*)&kSettingChecksum);
+    }
     else {
       return luaL_argerror(L, 1, "no such setting");
     }                                                                 /* name */
@@ -2653,10 +3669,646 @@ l_settings(lua_State *L) {                                /* name value? ...? */
 
 /** ======================================================================== */
 
+/* Writes to a FILE*, counting the bytes written. */
+typedef struct FileWriter {
+  FILE *file;
+  size_t written;
+} FileWriter;
+
+static int
+file_writer(lua_State *L, const void *p, size_t sz, void *ud) {
+  FileWriter *fw = (FileWriter*)ud;
+  (void) L; /* unused */
+  if (fwrite(p, 1, sz, fw->file) != sz) {
+    return 1;
+  }
+  fw->written += sz;
+  return 0;
+}
+
+/* Wall clock time in seconds, used for the autosave statistics. ANSI C has
+ * no precise wall clock, so other builds fall back to processor time, which
+ * leaves out the time spent waiting for the disk. */
+static lua_Number
+autosave_clock(void) {
+#if defined(LUA_USE_POSIX) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (lua_Number)ts.tv_sec + (lua_Number)ts.tv_nsec / 1e9;
+#elif defined(LUA_WIN)
+  LARGE_INTEGER counter, frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  return (lua_Number)counter.QuadPart / (lua_Number)frequency.QuadPart;
+#else
+  return (lua_Number)clock() / (lua_Number)CLOCKS_PER_SEC;
+#endif
+}
+
+/* Flushes a file's data to disk, so a rename can't overtake it. */
+static int
+autosave_sync(FILE *file) {
+  if (fflush(file)) {
+    return -1;
+  }
+#if defined(LUA_USE_POSIX)
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+  return fdatasync(fileno(file));
+#else
+  return fsync(fileno(file));
+#endif
+#else
+  return 0;
+#endif
+}
+
+/* Syncs the directory containing 'filename' so that a rename in it is
+ * durable. Best effort, since not all file systems support this. */
+static void
+autosave_syncdir(lua_State *L, const char *filename) {
+#if defined(LUA_USE_POSIX)
+  const char *slash = strrchr(filename, '/');
+  const char *dir = ".";
+  int fd;
+  if (slash == filename) {
+    dir = "/";
+  }
+  else if (slash) {
+    dir = lua_pushlstring(L, filename, slash - filename);          /* ... dir */
+  }
+  fd = open(dir, O_RDONLY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+  if (slash && slash != filename) {
+    lua_pop(L, 1);                                                     /* ... */
+  }
+#else
+  (void) L; (void) filename; /* unused */
+#endif
+}
+
+/* Renames 'from' to 'to', replacing 'to' if it exists. This is atomic on
+ * POSIX systems and on Windows; plain ANSI builds have to remove the target
+ * first, so there a crash at the wrong moment can lose the save. */
+static int
+autosave_replace(const char *from, const char *to) {
+#if defined(LUA_USE_POSIX)
+  return rename(from, to);
+#elif defined(LUA_WIN)
+  if (MoveFileExA(from, to,
+                  MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+    return 0;
+  }
+  errno = (GetLastError() == ERROR_FILE_NOT_FOUND) ? ENOENT : EACCES;
+  return -1;
+#else
+  remove(to);
+  return rename(from, to);
+#endif
+}
+
+#if !defined(LUA_USE_POSIX)
+/* Copies a file, for systems where we can't hard link it. */
+static int
+autosave_copy(const char *from, const char *to) {
+  char buffer[LUAL_BUFFERSIZE];
+  FILE *in, *out;
+  size_t n;
+  int result = 0;
+  if ((in = fopen(from, "rb")) == NULL) {
+    return -1;
+  }
+  if ((out = fopen(to, "wb")) == NULL) {
+    fclose(in);
+    return -1;
+  }
+  while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+    if (fwrite(buffer, 1, n, out) != n) {
+      result = -1;
+      break;
+    }
+  }
+  if (ferror(in) || autosave_sync(out)) {
+    result = -1;
+  }
+  fclose(in);
+  if (fclose(out)) {
+    result = -1;
+  }
+  if (result) {
+    remove(to);
+  }
+  return result;
+}
+#endif
+
+/* Moves generation 'from' of a save to generation 'to', where generation zero
+ * is the save itself. */
+static int
+autosave_shift(lua_State *L, const char *filename, int from, int to) {
+  int result;
+  if (from == 0) {
+    /* Keep the current save in place until the new one replaces it, so there
+     * is no point in time where it does not exist. */
+    lua_pushfstring(L, "%s.%d", filename, to);                      /* ... to */
+    remove(lua_tostring(L, -1));
+#if defined(LUA_USE_POSIX)
+    result = link(filename, lua_tostring(L, -1));
+#else
+    result = autosave_copy(filename, lua_tostring(L, -1));
+#endif
+    lua_pop(L, 1);                                                     /* ... */
+  }
+  else {
+    lua_pushfstring(L, "%s.%d", filename, from);               /* ... from */
+    lua_pushfstring(L, "%s.%d", filename, to);              /* ... from to */
+    result = autosave_replace(lua_tostring(L, -2), lua_tostring(L, -1));
+    lua_pop(L, 2);                                                     /* ... */
+  }
+  return (result && errno != ENOENT) ? -1 : 0;
+}
+
+/* Process id for temporary file names, so that processes saving to the same
+ * file don't write into each other's temporary file. */
+static int
+autosave_pid(void) {
+#if defined(LUA_USE_POSIX)
+  return (int)getpid();
+#elif defined(LUA_WIN)
+  return (int)GetCurrentProcessId();
+#else
+  return 0;
+#endif
+}
+
+static int
+autosave_dump(lua_State *L) {                                /* perms value fw */
+  FileWriter *fw = (FileWriter*)lua_touserdata(L, 3);
+  lua_settop(L, 2);                                            /* perms value */
+  eris_dump(L, file_writer, fw);                               /* perms value */
+  return 0;
+}
+
+static int
+l_autosave(lua_State *L) {           /* filename perms value generations? ...? */
+  const char *filename = luaL_checkstring(L, 1);
+  const int generations = luaL_optint(L, 4, 0);
+  const char *tmpname;
+  FileWriter fw;
+  lua_Number start, persisted, synced;
+  int status, i;
+
+  if (lua_isnoneornil(L, 2)) {
+    lua_newtable(L);                          /* filename nil value ...? perms */
+    lua_replace(L, 2);                          /* filename perms value ...? */
+  }
+  luaL_checktype(L, 2, LUA_TTABLE);
+  luaL_checkany(L, 3);
+  luaL_argcheck(L, generations >= 0, 4, "must not be negative");
+  lua_settop(L, 3);                                   /* filename perms value */
+
+  start = autosave_clock();
+
+  /* Stream the new save into a temporary file next to the target. The name
+   * is unique per process and, through the address of 'fw', per call. */
+  tmpname = lua_pushfstring(L, "%s.%d.%p.tmp", filename,
+                            autosave_pid(), (void*)&fw);
+                                              /* filename perms value tmpname */
+  fw.file = fopen(tmpname, "wb");
+  fw.written = 0;
+  if (fw.file == NULL) {
+    return luaL_error(L, ERIS_ERR_FILE, "open", tmpname, strerror(errno));
+  }
+  setvbuf(fw.file, NULL, _IOFBF, LUAL_BUFFERSIZE * 16);
+  lua_pushcfunction(L, autosave_dump);
+                                  /* filename perms value tmpname autosave_dump */
+  lua_pushvalue(L, 2);
+                            /* filename perms value tmpname autosave_dump perms */
+  lua_pushvalue(L, 3);
+                      /* filename perms value tmpname autosave_dump perms value */
+  lua_pushlightuserdata(L, &fw);
+                   /* filename perms value tmpname autosave_dump perms value fw */
+  status = lua_pcall(L, 3, 0, 0);         /* filename perms value tmpname err? */
+  persisted = autosave_clock();
+  if (status == LUA_OK && autosave_sync(fw.file)) {
+    lua_pushfstring(L, ERIS_ERR_FILE, "write", tmpname, strerror(errno));
+                                          /* filename perms value tmpname err */
+    status = LUA_ERRRUN;
+  }
+  if (fclose(fw.file) && status == LUA_OK) {
+    lua_pushfstring(L, ERIS_ERR_FILE, "close", tmpname, strerror(errno));
+                                          /* filename perms value tmpname err */
+    status = LUA_ERRRUN;
+  }
+  if (status != LUA_OK) {
+    remove(tmpname);
+    return lua_error(L);
+  }
+  synced = autosave_clock();
+
+  /* Rotate older generations, then atomically replace the save. */
+  for (i = generations; i > 0; --i) {
+    if (autosave_shift(L, filename, i - 1, i)) {
+      const char *name = lua_pushfstring(L, "%s.%d", filename, i - 1);
+      const char *error = strerror(errno);
+      remove(tmpname);
+      return luaL_error(L, ERIS_ERR_FILE, "rotate", name, error);
+    }
+  }
+  if (autosave_replace(tmpname, filename)) {
+    const char *error = strerror(errno);
+    remove(tmpname);
+    return luaL_error(L, ERIS_ERR_FILE, "rename", tmpname, error);
+  }
+  autosave_syncdir(L, filename);
+
+  lua_createtable(L, 0, 4);             /* filename perms value tmpname stats */
+  lua_pushnumber(L, (lua_Number)fw.written);
+  lua_setfield(L, -2, "bytes");
+  lua_pushnumber(L, persisted - start);
+  lua_setfield(L, -2, "persist");
+  lua_pushnumber(L, synced - persisted);
+  lua_setfield(L, -2, "sync");
+  lua_pushnumber(L, autosave_clock() - start);
+  lua_setfield(L, -2, "total");
+  return 1;
+}
+
+/** ======================================================================== */
+
+/* Bundles hold the persisted main functions of many modules in one file:
+ *   char magic[4] = "ERSB";
+ *   uint32_t version, count;
+ *   struct { uint32_t hash, name, namelen, data, datalen; } index[count];
+ *   ... names and persisted functions, at the offsets given in the index.
+ * The index is sorted by hash (then name), so a module can be found with a
+ * binary search. All values are little endian, like the data itself. */
+static char const kBundleHeader[] = { 'E', 'R', 'S', 'B' };
+#define BUNDLE_VERSION 1
+#define BUNDLE_HEADER_SIZE (sizeof(kBundleHeader) + 2 * sizeof(uint32_t))
+#define BUNDLE_ENTRY_SIZE (5 * sizeof(uint32_t))
+
+static const char *const kBundleMetatable = "eris.bundle";
+
+typedef struct Bundle {
+  const char *data;
+  size_t size;
+  bool mapped;
+} Bundle;
+
+typedef struct BundleEntry {
+  uint32_t hash;
+  const char *name;
+  size_t namelen;
+  const char *data;
+  size_t datalen;
+} BundleEntry;
+
+/* FNV-1a, cheap and good enough for module names. */
+static uint32_t
+bundle_hash(const char *name, size_t length) {
+  uint32_t hash = 2166136261u;
+  size_t i;
+  for (i = 0; i < length; ++i) {
+    hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static uint32_t
+bundle_uint32(const Bundle *bundle, size_t offset) {
+  return decode_uint32_t(bundle->data + offset);
+}
+
+static int
+bundle_compare(const void *a, const void *b) {
+  const BundleEntry *ea = (const BundleEntry*)a;
+  const BundleEntry *eb = (const BundleEntry*)b;
+  if (ea->hash != eb->hash) {
+    return ea->hash < eb->hash ? -1 : 1;
+  }
+  else {
+    const size_t n = ea->namelen < eb->namelen ? ea->namelen : eb->namelen;
+    const int result = memcmp(ea->name, eb->name, n);
+    if (result) {
+      return result;
+    }
+    return ea->namelen < eb->namelen ? -1 : ea->namelen > eb->namelen;
+  }
+}
+
+static int
+l_bundle(lua_State *L) {                               /* filename modules ...? */
+  const char *filename = luaL_checkstring(L, 1);
+  BundleEntry *entries;
+  FILE *file;
+  size_t count = 0, offset, i;
+  int ok;
+
+  luaL_checktype(L, 2, LUA_TTABLE);
+  lua_settop(L, 2);                                       /* filename modules */
+  lua_newtable(L);                                  /* filename modules perms */
+  lua_newtable(L);                          /* filename modules perms images */
+
+  /* Compile all modules and persist their main functions, without _ENV. */
+  lua_pushnil(L);                       /* filename modules perms images nil */
+  while (lua_next(L, 2)) {       /* filename modules perms images name path */
+    luaL_argcheck(L, lua_type(L, -2) == LUA_TSTRING, 2,
+                  "module names must be strings");
+    if (luaL_loadfile(L, luaL_checkstring(L, -1)) != LUA_OK) {
+                                /* filename modules perms images name path err */
+      return lua_error(L);
+    }                         /* filename modules perms images name path func */
+    if (lua_getupvalue(L, -1, 1)) {
+      lua_pop(L, 1);
+      lua_pushnil(L);
+                          /* filename modules perms images name path func nil */
+      lua_setupvalue(L, -2, 1);
+    }                         /* filename modules perms images name path func */
+    eris_persist(L, 3, -1);
+                         /* filename modules perms images name path func data */
+    lua_pushvalue(L, -4);
+                    /* filename modules perms images name path func data name */
+    lua_pushvalue(L, -2);
+               /* filename modules perms images name path func data name data */
+    lua_rawset(L, 4);    /* filename modules perms images name path func data */
+    lua_pop(L, 3);                       /* filename modules perms images name */
+    ++count;
+  }                                           /* filename modules perms images */
+
+  entries = (BundleEntry*)lua_newuserdata(L, (count ? count : 1) *
+                                             sizeof(BundleEntry));
+                                      /* filename modules perms images entries */
+  i = 0;
+  lua_pushnil(L);                 /* filename modules perms images entries nil */
+  while (lua_next(L, 4)) {   /* filename modules perms images entries name data */
+    BundleEntry *entry = &entries[i++];
+    entry->name = lua_tolstring(L, -2, &entry->namelen);
+    entry->data = lua_tolstring(L, -1, &entry->datalen);
+    entry->hash = bundle_hash(entry->name, entry->namelen);
+    lua_pop(L, 1);               /* filename modules perms images entries name */
+  }                                   /* filename modules perms images entries */
+  qsort(entries, count, sizeof(BundleEntry), bundle_compare);
+
+  file = fopen(filename, "wb");
+  if (file == NULL) {
+    return luaL_error(L, ERIS_ERR_FILE, "open", filename, strerror(errno));
+  }
+  ok = fwrite(kBundleHeader, sizeof(kBundleHeader), 1, file) == 1;
+  {
+    uint8_t header[2 * sizeof(uint32_t)];
+    encode_uint32_t(header, BUNDLE_VERSION);
+    encode_uint32_t(header + 4, (uint32_t)count);
+    ok = ok && fwrite(header, sizeof(header), 1, file) == 1;
+  }
+  offset = BUNDLE_HEADER_SIZE + count * BUNDLE_ENTRY_SIZE;
+  for (i = 0; i < count && ok; ++i) {
+    uint8_t entry[BUNDLE_ENTRY_SIZE];
+    encode_uint32_t(entry, entries[i].hash);
+    encode_uint32_t(entry + 4, (uint32_t)offset);
+    encode_uint32_t(entry + 8, (uint32_t)entries[i].namelen);
+    encode_uint32_t(entry + 12, (uint32_t)(offset + entries[i].namelen));
+    encode_uint32_t(entry + 16, (uint32_t)entries[i].datalen);
+    offset += entries[i].namelen + entries[i].datalen;
+    ok = fwrite(entry, sizeof(entry), 1, file) == 1;
+  }
+  for (i = 0; i < count && ok; ++i) {
+    ok = fwrite(entries[i].name, 1, entries[i].namelen, file) ==
+           entries[i].namelen &&
+         fwrite(entries[i].data, 1, entries[i].datalen, file) ==
+           entries[i].datalen;
+  }
+  if (fclose(file)) {
+    ok = false;
+  }
+  if (!ok || offset > UINT32_MAX) {
+    remove(filename);
+    return luaL_error(L, ERIS_ERR_FILE, "write", filename,
+                      ok ? "bundle too large" : strerror(errno));
+  }
+  lua_pushunsigned(L, (lua_Unsigned)count);
+  return 1;
+}
+
+static int
+bundle_gc(lua_State *L) {                                           /* bundle */
+  Bundle *bundle = (Bundle*)luaL_checkudata(L, 1, kBundleMetatable);
+  if (bundle->data) {
+#if defined(LUA_USE_POSIX)
+    if (bundle->mapped) {
+      munmap((void*)bundle->data, bundle->size);
+    }
+    else
+#endif
+    free((void*)bundle->data);
+    bundle->data = NULL;
+  }
+  return 0;
+}
+
+/* Maps the bundle file into memory, or reads it if mapping is unavailable. */
+static void
+bundle_open(lua_State *L, Bundle *bundle, const char *filename) {
+#if defined(LUA_USE_POSIX)
+  struct stat st;
+  const int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    luaL_error(L, ERIS_ERR_FILE, "open", filename, strerror(errno));
+  }
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      bundle->data = (const char*)data;
+      bundle->size = (size_t)st.st_size;
+      bundle->mapped = true;
+    }
+  }
+  close(fd);
+  if (bundle->data) {
+    return;
+  }
+#endif
+  {
+    FILE *file = fopen(filename, "rb");
+    char *data;
+    long size = 0;
+    if (file == NULL) {
+      luaL_error(L, ERIS_ERR_FILE, "open", filename, strerror(errno));
+    }
+    if (fseek(file, 0, SEEK_END) || (size = ftell(file)) < 0 ||
+        fseek(file, 0, SEEK_SET)) {
+      fclose(file);
+      luaL_error(L, ERIS_ERR_FILE, "read", filename, strerror(errno));
+    }
+    data = (char*)malloc(size ? (size_t)size : 1);
+    if (data == NULL) {
+      fclose(file);
+      luaL_error(L, ERIS_ERR_FILE, "read", filename, "not enough memory");
+    }
+    bundle->data = data;
+    bundle->size = (size_t)size;
+    if (fread(data, 1, bundle->size, file) != bundle->size) {
+      fclose(file);
+      luaL_error(L, ERIS_ERR_FILE, "read", filename, "read error");
+    }
+    fclose(file);
+  }
+}
+
+static void
+bundle_validate(lua_State *L, const Bundle *bundle, const char *filename) {
+  size_t count;
+  if (bundle->size < BUNDLE_HEADER_SIZE ||
+      memcmp(bundle->data, kBundleHeader, sizeof(kBundleHeader)) ||
+      bundle_uint32(bundle, sizeof(kBundleHeader)) != BUNDLE_VERSION) {
+    luaL_error(L, ERIS_ERR_BUNDLE, filename);
+  }
+  count = bundle_uint32(bundle, sizeof(kBundleHeader) + sizeof(uint32_t));
+  if (count > (bundle->size - BUNDLE_HEADER_SIZE) / BUNDLE_ENTRY_SIZE) {
+    luaL_error(L, ERIS_ERR_BUNDLE, filename);
+  }
+}
+
+/* Finds the index entry of a module, returns its offset or zero. */
+static size_t
+bundle_find(const Bundle *bundle, const char *name, size_t length) {
+  const uint32_t hash = bundle_hash(name, length);
+  size_t lo = 0;
+  size_t hi = bundle_uint32(bundle, sizeof(kBundleHeader) + sizeof(uint32_t));
+  /* Find the first entry with this hash, then compare the names of all
+   * entries with this hash. */
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (bundle_uint32(bundle, BUNDLE_HEADER_SIZE + mid * BUNDLE_ENTRY_SIZE) <
+        hash) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  for (hi = bundle_uint32(bundle, sizeof(kBundleHeader) + sizeof(uint32_t));
+       lo < hi; ++lo) {
+    const size_t entry = BUNDLE_HEADER_SIZE + lo * BUNDLE_ENTRY_SIZE;
+    const size_t offset = bundle_uint32(bundle, entry + sizeof(uint32_t));
+    const size_t namelen = bundle_uint32(bundle, entry + 2 * sizeof(uint32_t));
+    if (bundle_uint32(bundle, entry) != hash) {
+      break;
+    }
+    if (namelen == length && offset <= bundle->size &&
+        length <= bundle->size - offset &&
+        memcmp(bundle->data + offset, name, length) == 0) {
+      return entry;
+    }
+  }
+  return 0;
+}
+
+static int
+bundle_searcher(lua_State *L) {                                       /* name */
+  const Bundle *bundle = (const Bundle*)lua_touserdata(L, lua_upvalueindex(1));
+  size_t length, entry, offset, size;
+  const char *name = luaL_checklstring(L, 1, &length);
+  RBuffer buff;
+
+  if (bundle->data == NULL ||
+      (entry = bundle_find(bundle, name, length)) == 0) {
+    lua_pushfstring(L, "\n\tno module " LUA_QS " in bundle", name);
+    return 1;
+  }
+  offset = bundle_uint32(bundle, entry + 3 * sizeof(uint32_t));
+  size = bundle_uint32(bundle, entry + 4 * sizeof(uint32_t));
+  if (offset > bundle->size || size > bundle->size - offset) {
+    return luaL_error(L, ERIS_ERR_BUNDLE, name);
+  }
+
+  lua_settop(L, 1);                                                   /* name */
+  lua_newtable(L);                                              /* name perms */
+  lua_insert(L, PERMIDX);                                       /* perms name */
+  eris_buffer(&buff) = bundle->data + offset;
+  eris_bufflen(&buff) = size;
+  eris_sizebuffer(&buff) = size;
+  unchecked_unpersist(L, reader, &buff, true);            /* perms name func */
+  luaL_checktype(L, -1, LUA_TFUNCTION);
+
+  /* Set the environment like lua_load does for main chunks. */
+  if (lua_getupvalue(L, -1, 1)) {                     /* perms name func nil */
+    lua_pop(L, 1);                                        /* perms name func */
+    lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+                                                       /* perms name func _G */
+    lua_setupvalue(L, -2, 1);                             /* perms name func */
+  }
+  lua_pushliteral(L, "=bundle");                   /* perms name func origin */
+  return 2;
+}
+
+static int
+l_loadbundle(lua_State *L) {                          /* filename pos? ...? */
+  const char *filename = luaL_checkstring(L, 1);
+  Bundle *bundle;
+  int n, pos;
+
+  lua_settop(L, 2);                                          /* filename pos */
+  bundle = (Bundle*)lua_newuserdata(L, sizeof(Bundle));
+                                                      /* filename pos bundle */
+  bundle->data = NULL;
+  bundle->size = 0;
+  bundle->mapped = false;
+  if (luaL_newmetatable(L, kBundleMetatable)) {    /* filename pos bundle mt */
+    lua_pushcfunction(L, bundle_gc);         /* filename pos bundle mt gc */
+    lua_setfield(L, -2, "__gc");                   /* filename pos bundle mt */
+  }
+  lua_setmetatable(L, -2);                            /* filename pos bundle */
+  bundle_open(L, bundle, filename);
+  bundle_validate(L, bundle, filename);
+
+  /* Insert the searcher into package.searchers, per default right after the
+   * preload searcher, so bundled modules win over ones on the path. */
+  lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+                                               /* filename pos bundle loaded */
+  lua_getfield(L, -1, LUA_LOADLIBNAME);
+                                          /* filename pos bundle loaded package */
+  if (!lua_istable(L, -1)) {
+    return luaL_error(L, LUA_QL("package") " is not loaded");
+  }
+  lua_getfield(L, -1, "searchers");
+                                /* filename pos bundle loaded package searchers */
+  if (!lua_istable(L, -1)) {
+    return luaL_error(L, LUA_QL("package.searchers") " must be a table");
+  }
+  n = (int)lua_rawlen(L, -1);
+  pos = luaL_optint(L, 2, n < 2 ? n + 1 : 2);
+  luaL_argcheck(L, pos >= 1 && pos <= n + 1, 2, "position out of bounds");
+  for (; n >= pos; --n) {
+    lua_rawgeti(L, -1, n);
+                            /* filename pos bundle loaded package searchers f */
+    lua_rawseti(L, -2, n + 1);
+                                /* filename pos bundle loaded package searchers */
+  }
+  lua_pushvalue(L, 3);
+                         /* filename pos bundle loaded package searchers bundle */
+  lua_pushcclosure(L, bundle_searcher, 1);
+                       /* filename pos bundle loaded package searchers searcher */
+  lua_pushvalue(L, -1);
+              /* filename pos bundle loaded package searchers searcher searcher */
+  lua_rawseti(L, -3, pos);
+                       /* filename pos bundle loaded package searchers searcher */
+  return 1;
+}
+
+/** ======================================================================== */
+
 static luaL_Reg erislib[] = {
   { "persist", l_persist },
   { "unpersist", l_unpersist },
   { "settings", l_settings },
+  { "persist_many", l_persist_many },
+  { "unpersist_one", l_unpersist_one },
+  { "autosave", l_autosave },
+  { "bundle", l_bundle },
+  { "loadbundle", l_loadbundle },
   { NULL, NULL }
 };
 
@@ -2692,7 +4344,7 @@ eris_undump(lua_State *L, lua_Reader reader, void *ud) {            /* perms? */
     luaL_error(L, "too many arguments");
   }
   luaL_checktype(L, 1, LUA_TTABLE);                                  /* perms */
-  unchecked_unpersist(L, reader, ud);                        /* perms rootobj */
+  unchecked_unpersist(L, reader, ud, false);                 /* perms rootobj */
 }
 
 /** ======================================================================== */
@@ -2719,6 +4371,21 @@ eris_unpersist(lua_State *L, int perms, int value) {                   /* ... */
   lua_call(L, 2, 1);                                           /* ... rootobj */
 }
 
+LUA_API void
+eris_autosave(lua_State *L, int perms, int value,                      /* ... */
+              const char *filename, int generations) {
+  perms = lua_absindex(L, perms);
+  value = lua_absindex(L, value);
+  eris_checkstack(L, 5);
+  lua_pushcfunction(L, l_autosave);                         /* ... l_autosave */
+  lua_pushstring(L, filename);                     /* ... l_autosave filename */
+  lua_pushvalue(L, perms);                   /* ... l_autosave filename perms */
+  lua_pushvalue(L, value);             /* ... l_autosave filename perms value */
+  lua_pushinteger(L, generations);
+                                   /* ... l_autosave filename perms value gen */
+  lua_call(L, 4, 1);                                             /* ... stats */
+}
+
 LUA_API void
 eris_get_setting(lua_State *L, const char *name) {                     /* ... */
   eris_checkstack(L, 2);
@@ -2739,3 +4406,187 @@ eris_set_setting(lua_State *L, const char *name, int value) {          /* ... */
 
 /* }======================================================================== */
 
+
+/*
+** {===========================================================================
+** Prefetching reader.
+** ============================================================================
+*/
+
+/* The buffers form a ring: 'head' is the next buffer handed to the consumer,
+ * followed by 'filled' buffers with data, followed by the buffers the helper
+ * thread may fill. The buffer returned by the last read stays reserved until
+ * the next read, because the lua_Reader contract requires it to stay valid
+ * until then. Without thread support the reader degrades to reading each
+ * chunk synchronously. */
+struct eris_Prefetch {
+  FILE *file;
+  char *data;           /* count * size bytes of buffer memory */
+  size_t *lengths;      /* number of valid bytes in each buffer */
+  size_t count;
+  size_t size;
+  size_t head;
+  size_t filled;
+  bool holding;         /* whether the consumer holds the previous buffer */
+  bool eof;             /* whether the helper thread hit end of file/error */
+  bool stop;            /* whether the helper thread should terminate */
+#if defined(LUA_USE_PTHREAD)
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t readable;
+  pthread_cond_t writable;
+#endif
+};
+
+#if defined(LUA_USE_PTHREAD)
+
+static void*
+prefetch_thread(void *ud) {
+  eris_Prefetch *pf = (eris_Prefetch*)ud;
+  pthread_mutex_lock(&pf->lock);
+  for (;;) {
+    size_t index, length;
+    while (!pf->stop && pf->filled + pf->holding >= pf->count) {
+      pthread_cond_wait(&pf->writable, &pf->lock);
+    }
+    if (pf->stop) {
+      break;
+    }
+    /* The buffer is ours until we publish it, so read without the lock. */
+    index = (pf->head + pf->filled) % pf->count;
+    pthread_mutex_unlock(&pf->lock);
+    length = fread(pf->data + index * pf->size, 1, pf->size, pf->file);
+    pthread_mutex_lock(&pf->lock);
+    if (length > 0) {
+      pf->lengths[index] = length;
+      ++pf->filled;
+    }
+    if (length < pf->size) {
+      pf->eof = true;
+    }
+    pthread_cond_signal(&pf->readable);
+    if (pf->eof) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&pf->lock);
+  return NULL;
+}
+
+/* Starts the helper thread with all signals blocked: handlers such as the
+ * profiler's SIGPROF one set hooks on a Lua state and must only run in the
+ * thread using it. */
+static bool
+prefetch_start(eris_Prefetch *pf) {
+  sigset_t all, old;
+  int result;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  result = pthread_create(&pf->thread, NULL, prefetch_thread, pf);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  return result == 0;
+}
+
+#endif
+
+LUA_API eris_Prefetch*
+eris_prefetch_open(FILE *file, size_t count, size_t size) {
+  eris_Prefetch *pf;
+  if (file == NULL || size == 0) {
+    return NULL;
+  }
+  if (count < 2) {
+    count = 2; /* one held by the consumer, at least one to read ahead */
+  }
+  pf = (eris_Prefetch*)malloc(sizeof(eris_Prefetch));
+  if (pf == NULL) {
+    return NULL;
+  }
+  pf->file = file;
+  pf->count = count;
+  pf->size = size;
+  pf->head = 0;
+  pf->filled = 0;
+  pf->holding = false;
+  pf->eof = false;
+  pf->stop = false;
+  pf->data = (size <= (size_t)-1 / count) ? (char*)malloc(count * size) : NULL;
+  pf->lengths = (size_t*)malloc(count * sizeof(size_t));
+  if (pf->data == NULL || pf->lengths == NULL) {
+    free(pf->data);
+    free(pf->lengths);
+    free(pf);
+    return NULL;
+  }
+#if defined(LUA_USE_PTHREAD)
+  pthread_mutex_init(&pf->lock, NULL);
+  pthread_cond_init(&pf->readable, NULL);
+  pthread_cond_init(&pf->writable, NULL);
+  if (!prefetch_start(pf)) {
+    pthread_cond_destroy(&pf->writable);
+    pthread_cond_destroy(&pf->readable);
+    pthread_mutex_destroy(&pf->lock);
+    free(pf->data);
+    free(pf->lengths);
+    free(pf);
+    return NULL;
+  }
+#endif
+  return pf;
+}
+
+LUA_API const char*
+eris_prefetch_reader(lua_State *L, void *ud, size_t *sz) {
+  eris_Prefetch *pf = (eris_Prefetch*)ud;
+  const char *data = NULL;
+  (void) L; /* unused */
+  *sz = 0;
+#if defined(LUA_USE_PTHREAD)
+  pthread_mutex_lock(&pf->lock);
+  if (pf->holding) {
+    /* The previously returned buffer may be refilled now. */
+    pf->holding = false;
+    pthread_cond_signal(&pf->writable);
+  }
+  while (pf->filled == 0 && !pf->eof) {
+    pthread_cond_wait(&pf->readable, &pf->lock);
+  }
+  if (pf->filled > 0) {
+    data = pf->data + pf->head * pf->size;
+    *sz = pf->lengths[pf->head];
+    pf->head = (pf->head + 1) % pf->count;
+    --pf->filled;
+    pf->holding = true;
+  }
+  pthread_mutex_unlock(&pf->lock);
+#else
+  if (!pf->eof) {
+    *sz = fread(pf->data, 1, pf->size, pf->file);
+    pf->eof = *sz < pf->size;
+    data = *sz > 0 ? pf->data : NULL;
+  }
+#endif
+  return data;
+}
+
+LUA_API void
+eris_prefetch_close(eris_Prefetch *pf) {
+  if (pf == NULL) {
+    return;
+  }
+#if defined(LUA_USE_PTHREAD)
+  pthread_mutex_lock(&pf->lock);
+  pf->stop = true;
+  pthread_cond_signal(&pf->writable);
+  pthread_mutex_unlock(&pf->lock);
+  pthread_join(pf->thread, NULL);
+  pthread_cond_destroy(&pf->writable);
+  pthread_cond_destroy(&pf->readable);
+  pthread_mutex_destroy(&pf->lock);
+#endif
+  free(pf->data);
+  free(pf->lengths);
+  free(pf);
+}
+
+/* }======================================================================== */
@@ -26,6 +26,8 @@ THE SOFTWARE.
 #ifndef ERIS_H
 #define ERIS_H
 
+#include <stdio.h>
+
 #define ERIS_VERSION_MAJOR  "1"
 #define ERIS_VERSION_MINOR  "1"
 #define ERIS_VERSION_NUM    101
@@ -90,6 +92,22 @@ LUA_API void eris_persist(lua_State* L, int perms, int value);
  */
 LUA_API void eris_unpersist(lua_State* L, int perms, int value);
 
+/**
+ * Persists the value at the specified index 'value' into the file 'filename',
+ * using the perms table at the specified index 'perms', in a crash-safe way:
+ * the data is streamed into a temporary file, which is synced to disk and
+ * then atomically renamed to 'filename'. The previous 'generations' saves are
+ * kept as 'filename.1' (the most recent one) to 'filename.N'.
+ *
+ * Pushes a table with statistics onto the stack: 'bytes' written, and the
+ * time in seconds spent to 'persist' (including writing), to 'sync' and in
+ * 'total'.
+ *
+ * [-0, +1, e]
+ */
+LUA_API void eris_autosave(lua_State *L, int perms, int value,
+                           const char *filename, int generations);
+
 /**
  * Pushes the current value of a setting onto the stack.
  *
@@ -100,6 +118,9 @@ LUA_API void eris_unpersist(lua_State* L, int perms, int value);
  *            of tables, for example). This can be useful to avoid segmentation
  *            faults due to too deep recursion when working with user-provided
  *            data.
+ * - 'maxmem' the maximum number of bytes unpersisting may allocate, zero
+ *            for no limit. Useful to bound the memory used when loading
+ *            user-provided data.
  * - 'path'   whether to generate a "path" used to indicate where in an object
  *            an error occurred. This adds considerable overhead and should
  *            only be used to debug errors as they appear.
@@ -109,6 +130,12 @@ LUA_API void eris_unpersist(lua_State* L, int perms, int value);
  *            unpersisting it will pass along a ZIO*.
  * - 'spkey'  the name of the field in the metatable of tables and userdata
  *            used to control persistence (on/off or special persistence).
+ * - 'checksum' whether to append a CRC-32C checksum to persisted data, which
+ *            is verified when unpersisting. Data written this way can only be
+ *            read by Eris versions supporting checksums.
+ * - 'compact' whether to write integral numbers in a compact, variable length
+ *            encoding. Data written this way can only be read by Eris
+ *            versions supporting this encoding.
  *
  * If an unknown name is specified this will throw an error.
  *
@@ -128,6 +155,37 @@ LUA_API void eris_get_setting(lua_State *L, const char *name);
  */
 LUA_API void eris_set_setting(lua_State *L, const char *name, int value);
 
+/*
+** ==================================================================
+** Prefetching reader
+** ==================================================================
+*/
+
+typedef struct eris_Prefetch eris_Prefetch;
+
+/**
+ * Creates a reader that reads ahead from 'file' on a helper thread, keeping
+ * up to 'count' chunks of 'size' bytes each buffered, so that decoding can
+ * overlap with disk or pipe latency. Pass eris_prefetch_reader as the reader
+ * and the returned object as its 'ud' to eris_undump() or lua_load(). If the
+ * platform has no thread support, chunks are read synchronously instead.
+ *
+ * The file must stay open, and must not be accessed otherwise, until the
+ * reader is closed again. Returns NULL on failure.
+ */
+LUA_API eris_Prefetch *eris_prefetch_open(FILE *file, size_t count,
+                                          size_t size);
+
+/**
+ * The lua_Reader implementation to use with an eris_Prefetch object.
+ */
+LUA_API const char *eris_prefetch_reader(lua_State *L, void *ud, size_t *sz);
+
+/**
+ * Stops the helper thread and frees the reader. Does not close the file.
+ */
+LUA_API void eris_prefetch_close(eris_Prefetch *pf);
+
 /*
 ** ==================================================================
 ** Library installer
@@ -809,6 +809,33 @@ LUA_API void lua_rawsetp (lua_State *L, int idx, const void *p) {
 }
 
 
+/*
+** copies t1[f..e] into t2[t..] (raw), where t1 and t2 are the tables
+** at indices 'idx1' and 'idx2'
+*/
+LUA_API void lua_rawmove (lua_State *L, int idx1, int f, int e, int t,
+                                        int idx2) {
+  StkId t1, t2;
+  lua_lock(L);
+  t1 = index2addr(L, idx1);
+  t2 = index2addr(L, idx2);
+  api_check(L, ttistable(t1) && ttistable(t2), "table expected");
+  if (f <= e)
+    luaH_move(L, hvalue(t1), f, e, t, hvalue(t2));
+  lua_unlock(L);
+}
+
+
+LUA_API void lua_rawclear (lua_State *L, int idx) {
+  StkId t;
+  lua_lock(L);
+  t = index2addr(L, idx);
+  api_check(L, ttistable(t), "table expected");
+  luaH_clear(hvalue(t));
+  lua_unlock(L);
+}
+
+
 LUA_API int lua_setmetatable (lua_State *L, int objindex) {
   TValue *obj;
   Table *mt;
@@ -1062,6 +1089,10 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       }
       break;
     }
+    case LUA_GCSTEPUS: {
+      res = luaC_timedstep(L, data);
+      break;
+    }
     case LUA_GCSETPAUSE: {
       res = g->gcpause;
       g->gcpause = data;
@@ -1097,6 +1128,17 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
 
 
 
+LUA_API void lua_gcstats (lua_State *L, lua_GCStats *stats, int reset) {
+  global_State *g;
+  lua_lock(L);
+  g = G(L);
+  if (stats) *stats = g->gcstats;
+  if (reset) memset(&g->gcstats, 0, sizeof(g->gcstats));
+  lua_unlock(L);
+}
+
+
+
 /*
 ** miscellaneous functions
 */
@@ -1172,6 +1214,18 @@ LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
 }
 
 
+/*
+** Declare that the allocator releases all memory of the state when the
+** state's main block is freed, so 'lua_close' only runs finalizers
+** and does not free objects one by one.
+*/
+LUA_API void lua_setbulkfree (lua_State *L, int bulk) {
+  lua_lock(L);
+  G(L)->bulkfree = cast_byte(bulk != 0);
+  lua_unlock(L);
+}
+
+
 LUA_API void *lua_newuserdata (lua_State *L, size_t size) {
   Udata *u;
   lua_lock(L);
@@ -6,6 +6,7 @@
 
 
 #include <errno.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -627,6 +628,206 @@ static int skipcomment (LoadF *lf, int *cp) {
 }
 
 
+/*
+** {------------------------------------------------------
+** Bytecode cache
+** When a cache directory is set (see 'luaL_setcachedir'),
+** 'luaL_loadfilex' stores the precompiled form of each source file it
+** loads there and, next time, loads that binary chunk instead of
+** parsing the source again. An entry records the path, size,
+** modification time and a hash of the contents of its source, and is
+** used only while all of them still match; any problem with the cache
+** makes the loader fall back to the source. Loads whose mode does not
+** accept binary chunks never touch the cache, as its entries are
+** binary (and only as trustworthy as the cache directory).
+** -------------------------------------------------------
+*/
+
+#define CACHEDIRKEY	"_CACHEDIR"
+
+#if defined(LUA_USE_POSIX)
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHEMAGIC	"\033LuaCache1"
+#define CACHESEED	UINT64_C(0xcbf29ce484222325)
+
+typedef struct CacheHeader {
+  char magic[sizeof(CACHEMAGIC)];
+  uint64_t hash;  /* hash of the source contents */
+  uint64_t size;  /* size of the source */
+  int64_t mtime;  /* modification time of the source */
+  size_t pathlen;  /* length of the path that follows the header */
+} CacheHeader;
+
+
+static uint64_t cachehash (const char *s, size_t l, uint64_t h) {
+  for (; l > 0; l--)  /* FNV-1a */
+    h = (h ^ (unsigned char)*s++) * UINT64_C(0x100000001b3);
+  return h;
+}
+
+
+/*
+** push the identity of a file (the name it was loaded with and its
+** real path) and return the name of its cache entry
+*/
+static const char *cachename (lua_State *L, const char *dir,
+                              const char *filename) {
+  char hex[17];
+  const char *path;
+  size_t l;
+  char *real = realpath(filename, NULL);
+  lua_pushfstring(L, "%s\n%s", filename, (real != NULL) ? real : filename);
+  free(real);
+  path = lua_tolstring(L, -1, &l);
+  sprintf(hex, "%016llx", (unsigned long long)cachehash(path, l, CACHESEED));
+  return lua_pushfstring(L, "%s/%s.luac", dir, hex);
+}
+
+
+static int samepath (FILE *f, const char *path, size_t l) {
+  for (; l > 0; l--)
+    if (getc(f) != (unsigned char)*path++) return 0;
+  return 1;
+}
+
+
+/*
+** load the entry 'cname' if it matches 'h' and 'path'; return -1
+** (with nothing pushed) when it cannot be used
+*/
+static int readcache (lua_State *L, const char *cname, const CacheHeader *h,
+                      const char *path, const char *chunkname) {
+  LoadF lf;
+  CacheHeader ch;
+  int status;
+  lf.f = fopen(cname, "rb");
+  if (lf.f == NULL) return -1;
+  if (fread(&ch, sizeof(ch), 1, lf.f) != 1 ||
+      memcmp(&ch, h, sizeof(ch)) != 0 || !samepath(lf.f, path, h->pathlen)) {
+    fclose(lf.f);
+    return -1;
+  }
+  lf.n = 0;
+  status = lua_load(L, getF, &lf, chunkname, "b");
+  if (ferror(lf.f) && status == LUA_OK) status = LUA_ERRFILE;
+  fclose(lf.f);
+  if (status != LUA_OK) {  /* stale or damaged entry */
+    lua_pop(L, 1);
+    return -1;
+  }
+  return LUA_OK;
+}
+
+
+static int cachewriter (lua_State *L, const void *p, size_t sz, void *ud) {
+  (void)L;  /* not used */
+  return (fwrite(p, 1, sz, (FILE *)ud) != sz);
+}
+
+
+/*
+** store the function on the top of the stack as entry 'cname'; the
+** entry is written to a temporary file (unique to the process and the
+** call) and then renamed, so that concurrent loaders never see a
+** partial entry
+*/
+static void writecache (lua_State *L, const char *cname, const CacheHeader *h,
+                        const char *path) {
+  const char *tmp = lua_pushfstring(L, "%s.%d.%p", cname, (int)getpid(),
+                                    (void *)&tmp);
+  FILE *f = fopen(tmp, "wb");
+  if (f != NULL) {
+    int ok;
+    lua_pushvalue(L, -2);  /* function to be dumped */
+    ok = (fwrite(h, sizeof(*h), 1, f) == 1 &&
+          fwrite(path, 1, h->pathlen, f) == h->pathlen &&
+          lua_dump(L, cachewriter, f) == 0);
+    lua_pop(L, 1);
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp, cname) != 0)
+      remove(tmp);
+  }
+  lua_pop(L, 1);  /* remove 'tmp' */
+}
+
+
+/*
+** load 'filename' through the cache; return -1 (with nothing pushed)
+** when the cache does not apply, so that the caller loads it normally
+*/
+static int loadcached (lua_State *L, const char *filename,
+                       const char *mode, const char *chunkname) {
+  struct stat st;
+  FILE *f;
+  CacheHeader h;
+  const char *dir, *path, *cname;
+  char *src;
+  size_t size, start = 0;
+  int status, top = lua_gettop(L);
+  if (mode != NULL &&
+      (strchr(mode, 't') == NULL || strchr(mode, 'b') == NULL))
+    return -1;  /* entries are binary: only for loads accepting both */
+  lua_getfield(L, LUA_REGISTRYINDEX, CACHEDIRKEY);
+  dir = lua_tostring(L, -1);
+  if (dir == NULL || stat(filename, &st) != 0 || !S_ISREG(st.st_mode) ||
+      (f = fopen(filename, "rb")) == NULL) {
+    lua_settop(L, top);
+    return -1;
+  }
+  size = (size_t)st.st_size;
+  src = (char *)lua_newuserdata(L, size);
+  if (fread(src, 1, size, f) != size) size = 0;  /* read error */
+  fclose(f);
+  if (size >= 3 && memcmp(src, "\xEF\xBB\xBF", 3) == 0)
+    start = 3;  /* skip BOM */
+  if (start < size && src[start] == '#')  /* skip first-line comment */
+    while (start < size && src[start] != '\n') start++;  /* keep '\n' */
+  if (size == 0 || (start < size && src[start] == LUA_SIGNATURE[0])) {
+    lua_settop(L, top);  /* error or binary file: not for the cache */
+    return -1;
+  }
+  memset(&h, 0, sizeof(h));  /* clear padding, as it is compared too */
+  memcpy(h.magic, CACHEMAGIC, sizeof(CACHEMAGIC));
+  h.hash = cachehash(src, size, CACHESEED);
+  h.size = size;
+  h.mtime = (int64_t)st.st_mtime;
+  cname = cachename(L, dir, filename);
+  path = lua_tolstring(L, -2, &h.pathlen);
+  status = readcache(L, cname, &h, path, chunkname);
+  if (status != LUA_OK) {  /* no valid entry? */
+    status = luaL_loadbufferx(L, src + start, size - start, chunkname, mode);
+    if (status == LUA_OK)
+      writecache(L, cname, &h, path);
+  }
+  lua_replace(L, top + 1);  /* result replaces directory name */
+  lua_settop(L, top + 1);
+  return status;
+}
+
+#else
+
+#define loadcached(L,f,m,c)	(-1)
+
+#endif
+
+
+/*
+** set the directory used to cache compiled chunks ('NULL' disables
+** the cache)
+*/
+LUALIB_API void luaL_setcachedir (lua_State *L, const char *dir) {
+  if (dir == NULL) lua_pushnil(L);
+  else lua_pushstring(L, dir);
+  lua_setfield(L, LUA_REGISTRYINDEX, CACHEDIRKEY);
+}
+
+/* }------------------------------------------------------ */
+
+
 LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
                                              const char *mode) {
   LoadF lf;
@@ -639,6 +840,11 @@ LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
   }
   else {
     lua_pushfstring(L, "@%s", filename);
+    status = loadcached(L, filename, mode, lua_tostring(L, -1));
+    if (status >= 0) {  /* loaded through the cache? */
+      lua_remove(L, fnameindex);
+      return status;
+    }
     lf.f = fopen(filename, "r");
     if (lf.f == NULL) return errfile(L, "open", fnameindex);
   }
@@ -692,6 +898,371 @@ LUALIB_API int luaL_loadstring (lua_State *L, const char *s) {
   return luaL_loadbuffer(L, s, strlen(s), s);
 }
 
+
+/*
+** {------------------------------------------------------
+** Data loader
+** 'luaL_loaddata' evaluates a chunk of the form 'return <literal>',
+** where the literal is built only from tables, strings, numbers,
+** booleans and nil, by reading it straight into Lua values, without
+** generating and running code. Any chunk outside that subset (or that
+** the reader is not sure about) goes through 'lua_load' and is run.
+** Positional fields are stored in batches like OP_SETLIST does, so
+** that mixing them with explicit keys gives the same table.
+** -------------------------------------------------------
+*/
+
+#define DATAFLUSH	50	/* as LFIELDS_PER_FLUSH */
+#define DATADEPTH	200	/* maximum nesting of tables */
+
+#define disdigit(c)	((unsigned)((c) - '0') < 10)
+#define disxdigit(c)	(disdigit(c) || (unsigned)(((c) | 0x20) - 'a') < 6)
+#define disalpha(c)	((unsigned)(((c) | 0x20) - 'a') < 26 || (c) == '_')
+#define disalnum(c)	(disalpha(c) || disdigit(c))
+#define disspace(c)	((c) == ' ' || (unsigned)((c) - '\t') < 5)
+#define dhexvalue(c)	(disdigit(c) ? (c) - '0' : ((c) | 0x20) - 'a' + 10)
+
+typedef struct LoadD {
+  const char *p;  /* current position */
+  const char *end;  /* end of the chunk */
+  int depth;  /* nesting of tables */
+} LoadD;
+
+
+static const char *const datareserved[] = {
+  "and", "break", "do", "else", "elseif", "end", "false", "for",
+  "function", "goto", "if", "in", "local", "nil", "not", "or", "repeat",
+  "return", "then", "true", "until", "while", NULL
+};
+
+
+#define dcur(d)		((d)->p < (d)->end ? (unsigned char)*(d)->p : EOF)
+#define dnext(d)	((d)->p + 1 < (d)->end ? (unsigned char)(d)->p[1] : EOF)
+
+
+/*
+** if at the opening of a long bracket, skip it and return its level;
+** otherwise return -1
+*/
+static int dopenlong (LoadD *d) {
+  const char *p = d->p + 1;
+  int level;
+  while (p < d->end && *p == '=') p++;
+  if (p >= d->end || *p != '[') return -1;
+  level = (int)(p - d->p) - 1;
+  d->p = p + 1;
+  return level;
+}
+
+
+/*
+** skip the body of a long bracket of the given level; returns its
+** contents in '*s' and '*l', or 0 if it is unterminated
+*/
+static int dskiplong (LoadD *d, int level, const char **s, size_t *l) {
+  const char *p = d->p;
+  if (p < d->end && (*p == '\n' || *p == '\r')) {  /* skip first newline */
+    p++;
+    if (p < d->end && (*p == '\n' || *p == '\r') && *p != p[-1]) p++;
+  }
+  *s = p;
+  for (; p < d->end; p++) {
+    if (*p == ']') {
+      const char *q = p + 1;
+      while (q < d->end && *q == '=') q++;
+      if (q < d->end && *q == ']' && q - p - 1 == level) {
+        *l = (size_t)(p - *s);
+        d->p = q + 1;
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+
+/* skip white space and comments; returns 0 on a malformed comment */
+static int dskip (LoadD *d) {
+  for (;;) {
+    int c = dcur(d);
+    if (disspace(c))
+      d->p++;
+    else if (c == '-' && dnext(d) == '-') {
+      int level;
+      const char *s;
+      size_t l;
+      d->p += 2;
+      if (dcur(d) == '[' && (level = dopenlong(d)) >= 0) {
+        if (!dskiplong(d, level, &s, &l)) return 0;
+      }
+      else
+        while (d->p < d->end && *d->p != '\n' && *d->p != '\r') d->p++;
+    }
+    else
+      return 1;
+  }
+}
+
+
+static int dname (LoadD *d, const char **s, size_t *l) {
+  const char *p = d->p;
+  int i;
+  if (!disalpha(dcur(d))) return 0;
+  while (d->p < d->end && disalnum(*d->p)) d->p++;
+  *s = p;
+  *l = (size_t)(d->p - p);
+  for (i = 0; datareserved[i] != NULL; i++)
+    if (datareserved[i][0] == *p && strlen(datareserved[i]) == *l &&
+        memcmp(datareserved[i], p, *l) == 0)
+      return 2;  /* reserved word */
+  return 1;
+}
+
+
+static int dnumber (lua_State *L, LoadD *d) {
+  const char *p = d->p;
+  const char *expo = "Ee";
+  int isnum;
+  if (*p == '0' && p + 1 < d->end && (p[1] == 'x' || p[1] == 'X')) {
+    expo = "Pp";
+    p += 2;
+  }
+  while (p < d->end) {  /* same extent as the lexer's 'read_numeral' */
+    if (*p == expo[0] || *p == expo[1]) {
+      p++;
+      if (p < d->end && (*p == '+' || *p == '-')) p++;
+    }
+    else if (disxdigit(*p) || *p == '.') p++;
+    else break;
+  }
+  if (expo[0] == 'E' && p - d->p < LUAI_MAXNUMBER2STR) {  /* decimal? */
+    char buff[LUAI_MAXNUMBER2STR];
+    char *endptr;
+    lua_Number n;
+    memcpy(buff, d->p, p - d->p);
+    buff[p - d->p] = '\0';
+    n = lua_str2number(buff, &endptr);
+    if (endptr != buff + (p - d->p)) return 0;  /* malformed */
+    lua_pushnumber(L, n);
+    d->p = p;
+    return 1;
+  }
+  lua_pushlstring(L, d->p, (size_t)(p - d->p));  /* hexadecimal (or huge) */
+  lua_pushnumber(L, lua_tonumberx(L, -1, &isnum));
+  lua_remove(L, -2);
+  d->p = p;
+  return isnum;
+}
+
+
+static int dstring (lua_State *L, LoadD *d) {
+  int del = *d->p++;
+  const char *s = d->p;
+  luaL_Buffer b;
+  while (d->p < d->end && *d->p != del && *d->p != '\\') {
+    if (*d->p == '\n' || *d->p == '\r') return 0;
+    d->p++;
+  }
+  if (d->p >= d->end) return 0;
+  if (*d->p == del) {  /* no escapes: common case */
+    lua_pushlstring(L, s, (size_t)(d->p++ - s));
+    return 1;
+  }
+  luaL_buffinit(L, &b);
+  luaL_addlstring(&b, s, (size_t)(d->p - s));
+  while (d->p < d->end && *d->p != del) {
+    int c = *d->p++;
+    if (c == '\n' || c == '\r') return 0;
+    if (c == '\\') {
+      if (d->p >= d->end) return 0;
+      c = *d->p++;
+      switch (c) {
+        case 'a': c = '\a'; break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'v': c = '\v'; break;
+        case '\\': case '"': case '\'': break;
+        case 'x': {
+          if (d->end - d->p < 2 || !disxdigit(d->p[0]) || !disxdigit(d->p[1]))
+            return 0;
+          c = (dhexvalue(d->p[0]) << 4) + dhexvalue(d->p[1]);
+          d->p += 2;
+          break;
+        }
+        case 'z': {
+          while (d->p < d->end && disspace(*d->p)) d->p++;
+          continue;
+        }
+        default: {
+          int i;
+          if (!disdigit(c)) return 0;  /* newlines and others: give up */
+          c -= '0';
+          for (i = 1; i < 3 && d->p < d->end && disdigit(*d->p); i++)
+            c = c * 10 + (*d->p++ - '0');
+          if (c > UCHAR_MAX) return 0;
+          break;
+        }
+      }
+    }
+    luaL_addchar(&b, (char)c);
+  }
+  if (d->p >= d->end) return 0;
+  d->p++;  /* skip delimiter */
+  luaL_pushresult(&b);
+  return 1;
+}
+
+
+static int dvalue (lua_State *L, LoadD *d);
+
+
+/* store 'n' pending positional values, the last at index 'last' */
+static void dflush (lua_State *L, int t, int n, int last) {
+  for (; n > 0; n--)
+    lua_rawseti(L, t, last--);
+}
+
+
+static int dtable (lua_State *L, LoadD *d) {
+  int t, pending = 0, na = 0;
+  if (++d->depth > DATADEPTH) return 0;
+  luaL_checkstack(L, DATAFLUSH + LUA_MINSTACK, "data too complex");
+  d->p++;  /* skip '{' */
+  lua_newtable(L);
+  t = lua_gettop(L);
+  for (;;) {
+    const char *s, *start;
+    size_t l;
+    if (!dskip(d)) return 0;
+    if (dcur(d) == '}') break;
+    start = d->p;
+    if (dcur(d) == '[' && dnext(d) != '[' && dnext(d) != '=') {  /* [k]=v */
+      d->p++;
+      if (!dskip(d) || !dvalue(L, d) || lua_isnil(L, -1) || !dskip(d) ||
+          dcur(d) != ']')
+        return 0;
+      d->p++;
+      if (!dskip(d) || dcur(d) != '=' || (d->p++, !dskip(d)) ||
+          !dvalue(L, d))
+        return 0;
+      lua_rawset(L, t);
+    }
+    else if (dname(d, &s, &l) == 1) {  /* name = v */
+      if (!dskip(d) || dcur(d) != '=' || dnext(d) == '=') return 0;
+      d->p++;
+      lua_pushlstring(L, s, l);
+      if (!dskip(d) || !dvalue(L, d)) return 0;
+      lua_rawset(L, t);
+    }
+    else {  /* positional value */
+      d->p = start;  /* (a keyword such as 'true' is read again) */
+      if (!dvalue(L, d)) return 0;
+      na++;
+      if (++pending == DATAFLUSH) {
+        dflush(L, t, pending, na);
+        pending = 0;
+      }
+    }
+    if (!dskip(d)) return 0;
+    if (dcur(d) == ',' || dcur(d) == ';') d->p++;
+    else if (dcur(d) != '}') return 0;
+  }
+  dflush(L, t, pending, na);
+  d->p++;  /* skip '}' */
+  d->depth--;
+  return 1;
+}
+
+
+/* read a literal and push it; returns 0 if it is not a plain literal */
+static int dvalue (lua_State *L, LoadD *d) {
+  int c = dcur(d);
+  const char *s;
+  size_t l;
+  switch (c) {
+    case '{': return dtable(L, d);
+    case '"': case '\'': return dstring(L, d);
+    case '[': {
+      int level = dopenlong(d);
+      if (level < 0 || !dskiplong(d, level, &s, &l) || memchr(s, '\r', l))
+        return 0;  /* (a '\r' would have to be translated) */
+      lua_pushlstring(L, s, l);
+      return 1;
+    }
+    case '-': {
+      d->p++;
+      if (!dskip(d) || !(disdigit(dcur(d)) ||
+          (dcur(d) == '.' && disdigit(dnext(d)))) || !dnumber(L, d))
+        return 0;
+      lua_pushnumber(L, -lua_tonumber(L, -1));
+      lua_remove(L, -2);
+      return 1;
+    }
+    default: {
+      if (disdigit(c) || (c == '.' && disdigit(dnext(d))))
+        return dnumber(L, d);
+      if (dname(d, &s, &l) != 2) return 0;
+      if (l == 3 && memcmp(s, "nil", 3) == 0) lua_pushnil(L);
+      else if (l == 4 && memcmp(s, "true", 4) == 0) lua_pushboolean(L, 1);
+      else if (l == 5 && memcmp(s, "false", 5) == 0) lua_pushboolean(L, 0);
+      else return 0;
+      return 1;
+    }
+  }
+}
+
+
+/*
+** read 'return <literal>' from the chunk in the light userdata at
+** index 1; returns the value and true, or nothing
+*/
+static int dchunk (lua_State *L) {
+  LoadD d = *(LoadD *)lua_touserdata(L, 1);
+  const char *s;
+  size_t l;
+  if (dskip(&d) && dname(&d, &s, &l) == 2 && l == 6 &&
+      memcmp(s, "return", 6) == 0 && dskip(&d) && dvalue(L, &d) &&
+      dskip(&d)) {
+    if (dcur(&d) == ';') {
+      d.p++;
+      if (!dskip(&d)) return 0;
+    }
+    if (d.p == d.end) {
+      lua_pushboolean(L, 1);
+      return 2;
+    }
+  }
+  return 0;  /* not plain data */
+}
+
+
+LUALIB_API int luaL_loaddata (lua_State *L, const char *buff, size_t size,
+                                            const char *name) {
+  LoadD d;
+  int status;
+  d.p = buff;
+  d.end = buff + size;
+  d.depth = 0;
+  lua_pushcfunction(L, dchunk);
+  lua_pushlightuserdata(L, &d);
+  status = lua_pcall(L, 1, 2, 0);
+  if (status != LUA_OK) return status;  /* memory error */
+  if (lua_toboolean(L, -1)) {  /* was it plain data? */
+    lua_pop(L, 1);
+    return LUA_OK;
+  }
+  lua_pop(L, 2);
+  status = luaL_loadbuffer(L, buff, size, name);  /* not data: run it */
+  if (status == LUA_OK)
+    status = lua_pcall(L, 0, 1, 0);
+  return status;
+}
+
+/* }------------------------------------------------------ */
+
 /* }====================================================== */
 
 
@@ -941,6 +1512,390 @@ LUALIB_API lua_State *luaL_newstate (void) {
 }
 
 
+/*
+** {======================================================
+** Deferred freeing
+** A state created by 'luaL_newdeferstate' hands the blocks it frees
+** to a helper thread instead of returning them to the system allocator
+** inline, which takes that work (and the allocator's locks) off the
+** thread running the collector. The queue is a single-producer,
+** single-consumer ring: only the thread owning the state pushes and
+** only the helper pops, so neither side needs a lock. When the ring is
+** full the block is freed synchronously.
+** =======================================================
+*/
+
+#if defined(LUA_USE_PTHREAD) && defined(__GNUC__)
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+
+#if !defined(LUAL_DEFERQUEUE)
+#define LUAL_DEFERQUEUE	4096	/* maximum number of pending blocks */
+#endif
+
+#define DEFERBATCH	64	/* wake the helper every this many blocks */
+
+typedef struct DeferState {
+  void *queue[LUAL_DEFERQUEUE];
+  size_t head;  /* next slot to fill; written only by the owner */
+  size_t tail;  /* next slot to free; written only by the helper */
+  int stop;  /* set by the owner when the state is being closed */
+  int creating;  /* inside 'lua_newstate' */
+  void *lg;  /* main block of the state; its release closes the queue */
+  sem_t wakeup;
+  pthread_t helper;
+} DeferState;
+
+
+static void *deferhelper (void *ud) {
+  DeferState *d = (DeferState *)ud;
+  for (;;) {
+    int stop;
+    size_t head, tail = d->tail;
+    while (sem_wait(&d->wakeup) != 0) ;  /* retry on EINTR */
+    stop = __atomic_load_n(&d->stop, __ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&d->head, __ATOMIC_ACQUIRE);
+    while (tail != head)
+      free(d->queue[tail++ % LUAL_DEFERQUEUE]);
+    __atomic_store_n(&d->tail, tail, __ATOMIC_RELEASE);
+    if (stop) return NULL;  /* everything pushed before 'stop' is freed */
+  }
+}
+
+
+static void deferfree (DeferState *d, void *ptr) {
+  size_t head = d->head;
+  if (head - __atomic_load_n(&d->tail, __ATOMIC_ACQUIRE) >= LUAL_DEFERQUEUE) {
+    free(ptr);  /* queue is full: free it ourselves */
+    sem_post(&d->wakeup);
+    return;
+  }
+  d->queue[head % LUAL_DEFERQUEUE] = ptr;
+  __atomic_store_n(&d->head, head + 1, __ATOMIC_RELEASE);
+  if ((head + 1) % DEFERBATCH == 0)
+    sem_post(&d->wakeup);
+}
+
+
+static void deferclose (DeferState *d) {
+  __atomic_store_n(&d->stop, 1, __ATOMIC_RELEASE);
+  sem_post(&d->wakeup);
+  pthread_join(d->helper, NULL);
+  sem_destroy(&d->wakeup);
+}
+
+
+static void *deferalloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  DeferState *d = (DeferState *)ud;
+  (void)osize;  /* not used */
+  if (nsize == 0) {
+    if (ptr == NULL) return NULL;
+    else if (ptr == d->lg) {  /* state is being closed? */
+      deferclose(d);  /* drain the queue and stop the helper */
+      free(ptr);
+      if (!d->creating) free(d);
+    }
+    else
+      deferfree(d, ptr);
+    return NULL;
+  }
+  else if (ptr == NULL && d->lg == NULL)  /* first block is the state */
+    return d->lg = malloc(nsize);
+  else
+    return realloc(ptr, nsize);
+}
+
+
+/*
+** starts the helper with all signals blocked: handlers (such as the
+** profiler's) set hooks on the state and must run in its own thread
+*/
+static int deferstart (DeferState *d) {
+  sigset_t all, old;
+  int res;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  res = pthread_create(&d->helper, NULL, deferhelper, d);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  return (res == 0);
+}
+
+
+LUALIB_API lua_State *luaL_newdeferstate (void) {
+  lua_State *L;
+  DeferState *d = (DeferState *)malloc(sizeof(DeferState));
+  if (d == NULL) return NULL;
+  d->head = d->tail = 0;
+  d->stop = 0;
+  d->creating = 1;
+  d->lg = NULL;
+  if (sem_init(&d->wakeup, 0, 0) != 0) {
+    free(d);
+    return luaL_newstate();
+  }
+  if (!deferstart(d)) {
+    sem_destroy(&d->wakeup);
+    free(d);
+    return luaL_newstate();  /* no thread: use the synchronous allocator */
+  }
+  L = lua_newstate(deferalloc, d);
+  if (L == NULL) {
+    if (d->lg == NULL) deferclose(d);  /* helper still running? */
+    free(d);
+    return NULL;
+  }
+  d->creating = 0;
+  lua_atpanic(L, &panic);
+  return L;
+}
+
+#else
+
+LUALIB_API lua_State *luaL_newdeferstate (void) {
+  return luaL_newstate();
+}
+
+#endif
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Pool allocator
+** A state created by 'luaL_newpoolstate' serves small blocks (up to
+** LUAL_POOLMAX bytes) from per-state slabs, one free list per size
+** class. Lua always tells the allocator the size of the block being
+** freed or resized, so blocks need no header. Larger blocks go to the
+** system allocator. All slabs are released together when the state
+** is closed.
+** A state created by 'luaL_newarenastate' uses the same pools but also
+** keeps its large blocks in a list, so that closing the state can
+** release all its memory in bulk: 'lua_close' then only runs the
+** pending finalizers and skips freeing each object (see
+** 'lua_setbulkfree').
+** =======================================================
+*/
+
+#if !defined(LUAL_POOLMAX)
+#define LUAL_POOLMAX	256	/* largest block served from the pools */
+#endif
+
+#if !defined(LUAL_POOLSLAB)
+#define LUAL_POOLSLAB	(64 * 1024)	/* size of each slab */
+#endif
+
+#define POOLGRAIN	8	/* size classes are multiples of this */
+#define NUMCLASSES	(LUAL_POOLMAX / POOLGRAIN)
+
+#define sizeclass(s)	(((s) - 1) / POOLGRAIN)
+#define classsize(c)	(((c) + 1) * POOLGRAIN)
+#define inpool(s)	((s) > 0 && (s) <= LUAL_POOLMAX)
+
+
+typedef union PoolSlab {
+  union PoolSlab *next;
+  union { double u; void *s; long l; } align;  /* blocks follow this */
+} PoolSlab;
+
+
+/* header of a large block in an arena */
+typedef union LargeBlock {
+  struct { union LargeBlock *prev, *next; } l;
+  union { double u; void *s; long l; } align;  /* block follows this */
+} LargeBlock;
+
+
+typedef struct PoolState {
+  void *freeblocks[NUMCLASSES];  /* free list of each size class */
+  char *cur, *end;  /* unused part of the newest slab */
+  PoolSlab *slabs;  /* list of all slabs */
+  LargeBlock large;  /* list of large blocks (only in arenas) */
+  int arena;  /* true if large blocks are tracked for bulk release */
+  void *lg;  /* main block of the state; its release frees the slabs */
+  int creating;  /* inside 'lua_newstate' */
+  luaL_PoolStats stats;
+} PoolState;
+
+
+static void *poolget (PoolState *p, size_t size) {
+  int c = sizeclass(size);
+  size_t bsize = classsize(c);
+  void *block = p->freeblocks[c];
+  if (block != NULL)
+    p->freeblocks[c] = *(void **)block;
+  else {
+    if ((size_t)(p->end - p->cur) < bsize) {  /* slab exhausted? */
+      PoolSlab *slab = (PoolSlab *)malloc(sizeof(PoolSlab) + LUAL_POOLSLAB);
+      if (slab == NULL) return NULL;
+      slab->next = p->slabs;
+      p->slabs = slab;
+      p->cur = (char *)(slab + 1);
+      p->end = p->cur + LUAL_POOLSLAB;
+      p->stats.slabbytes += LUAL_POOLSLAB;
+    }
+    block = p->cur;
+    p->cur += bsize;
+  }
+  p->stats.poolbytes += bsize;
+  p->stats.poolallocs++;
+  return block;
+}
+
+
+static void poolput (PoolState *p, void *block, size_t size) {
+  int c = sizeclass(size);
+  *(void **)block = p->freeblocks[c];
+  p->freeblocks[c] = block;
+  p->stats.poolbytes -= classsize(c);
+}
+
+
+static void linkblock (PoolState *p, LargeBlock *b) {
+  b->l.prev = &p->large;
+  b->l.next = p->large.l.next;
+  b->l.next->l.prev = b;
+  p->large.l.next = b;
+}
+
+
+/*
+** resize a large block; in an arena, large blocks carry a header that
+** links them in list 'p->large'
+*/
+static void *largerealloc (PoolState *p, void *ptr, size_t nsize) {
+  LargeBlock *b, *nb;
+  if (!p->arena) {
+    if (nsize == 0) { free(ptr); return NULL; }
+    else return realloc(ptr, nsize);
+  }
+  b = (ptr == NULL) ? NULL : (LargeBlock *)ptr - 1;
+  if (b != NULL) {  /* unlink old block */
+    b->l.prev->l.next = b->l.next;
+    b->l.next->l.prev = b->l.prev;
+  }
+  if (nsize == 0) {
+    free(b);
+    return NULL;
+  }
+  nb = (LargeBlock *)realloc(b, sizeof(LargeBlock) + nsize);
+  if (nb == NULL) {  /* old block (if any) is still valid */
+    if (b != NULL) linkblock(p, b);
+    return NULL;
+  }
+  linkblock(p, nb);
+  return nb + 1;
+}
+
+
+static void poolclose (PoolState *p) {
+  while (p->slabs != NULL) {
+    PoolSlab *next = p->slabs->next;
+    free(p->slabs);
+    p->slabs = next;
+  }
+  if (p->arena) {
+    LargeBlock *b = p->large.l.next;
+    while (b != &p->large) {
+      LargeBlock *next = b->l.next;
+      free(b);
+      b = next;
+    }
+    p->large.l.prev = p->large.l.next = &p->large;
+  }
+}
+
+
+static void *poolalloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  PoolState *p = (PoolState *)ud;
+  void *newblock;
+  if (ptr == NULL) osize = 0;  /* 'osize' is just a type tag */
+  if (nsize == 0) {
+    if (ptr == NULL) return NULL;
+    else if (ptr == p->lg) {  /* state is being closed? */
+      poolclose(p);
+      free(ptr);
+      if (!p->creating) free(p);
+    }
+    else if (inpool(osize))
+      poolput(p, ptr, osize);
+    else
+      largerealloc(p, ptr, 0);
+    return NULL;
+  }
+  else if (ptr == NULL && p->lg == NULL)  /* first block is the state */
+    return p->lg = malloc(nsize);
+  else if (!inpool(nsize) && !inpool(osize)) {  /* system block? */
+    p->stats.largeallocs++;
+    return largerealloc(p, ptr, nsize);
+  }
+  else if (inpool(osize) && inpool(nsize) &&
+           sizeclass(osize) == sizeclass(nsize))
+    return ptr;  /* block already has the right size */
+  /* moving between size classes or between a class and the system */
+  if (inpool(nsize))
+    newblock = poolget(p, nsize);
+  else {
+    newblock = largerealloc(p, NULL, nsize);
+    p->stats.largeallocs++;
+  }
+  if (newblock == NULL)  /* shrinking cannot fail: keep the old block */
+    return (nsize < osize) ? ptr : NULL;  /* (a system block kept here
+                                  is recycled by the pool, never freed) */
+  if (ptr != NULL) {
+    memcpy(newblock, ptr, (osize < nsize) ? osize : nsize);
+    if (inpool(osize)) poolput(p, ptr, osize);
+    else largerealloc(p, ptr, 0);
+  }
+  return newblock;
+}
+
+
+static lua_State *newpoolstate (int arena) {
+  lua_State *L;
+  PoolState *p = (PoolState *)malloc(sizeof(PoolState));
+  if (p == NULL) return NULL;
+  memset(p, 0, sizeof(PoolState));
+  p->large.l.prev = p->large.l.next = &p->large;
+  p->arena = arena;
+  p->creating = 1;
+  L = lua_newstate(poolalloc, p);
+  if (L == NULL) {
+    poolclose(p);
+    free(p);
+    return NULL;
+  }
+  p->creating = 0;
+  lua_atpanic(L, &panic);
+  return L;
+}
+
+
+LUALIB_API lua_State *luaL_newpoolstate (void) {
+  return newpoolstate(0);
+}
+
+
+LUALIB_API lua_State *luaL_newarenastate (void) {
+  lua_State *L = newpoolstate(1);
+  if (L) lua_setbulkfree(L, 1);
+  return L;
+}
+
+
+LUALIB_API int luaL_poolstats (lua_State *L, luaL_PoolStats *stats) {
+  void *ud;
+  if (lua_getallocf(L, &ud) != poolalloc)
+    return 0;  /* not a pool state */
+  *stats = ((PoolState *)ud)->stats;
+  return 1;
+}
+
+/* }====================================================== */
+
+
 LUALIB_API void luaL_checkversion_ (lua_State *L, lua_Number ver) {
   const lua_Number *v = lua_version(L);
   if (v != lua_version(NULL))
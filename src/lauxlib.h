@@ -77,11 +77,27 @@ LUALIB_API int (luaL_loadfilex) (lua_State *L, const char *filename,
 
 #define luaL_loadfile(L,f)	luaL_loadfilex(L,f,NULL)
 
+LUALIB_API void (luaL_setcachedir) (lua_State *L, const char *dir);
+
 LUALIB_API int (luaL_loadbufferx) (lua_State *L, const char *buff, size_t sz,
                                    const char *name, const char *mode);
 LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s);
+LUALIB_API int (luaL_loaddata) (lua_State *L, const char *buff, size_t sz,
+                                const char *name);
 
 LUALIB_API lua_State *(luaL_newstate) (void);
+LUALIB_API lua_State *(luaL_newdeferstate) (void);
+
+typedef struct luaL_PoolStats {
+  size_t slabbytes;  /* memory reserved for slabs */
+  size_t poolbytes;  /* memory in pooled blocks currently in use */
+  size_t poolallocs;  /* allocations served from the pools */
+  size_t largeallocs;  /* allocations passed to the system allocator */
+} luaL_PoolStats;
+
+LUALIB_API lua_State *(luaL_newpoolstate) (void);
+LUALIB_API lua_State *(luaL_newarenastate) (void);
+LUALIB_API int (luaL_poolstats) (lua_State *L, luaL_PoolStats *stats);
 
 LUALIB_API int (luaL_len) (lua_State *L, int idx);
 
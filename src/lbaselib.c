@@ -157,16 +157,58 @@ static int luaB_rawset (lua_State *L) {
 }
 
 
+/* pseudo option of 'collectgarbage' handled by 'gcstats' */
+#define GCSTATS		(-1)
+
+/* pushes the collector statistics; resets them if 'reset' */
+static int gcstats (lua_State *L, int reset) {
+  static const char *const phases[LUA_GCPHASES] = {"propagate", "atomic",
+    "sweepstring", "sweepudata", "sweep"};
+  lua_GCStats stats;
+  int i;
+  lua_gcstats(L, &stats, reset);
+  lua_createtable(L, 0, 7);
+  lua_createtable(L, 0, LUA_GCPHASES);
+  for (i = 0; i < LUA_GCPHASES; i++) {
+    lua_pushnumber(L, stats.time[i]);
+    lua_setfield(L, -2, phases[i]);
+  }
+  lua_setfield(L, -2, "time");
+  lua_createtable(L, 0, LUA_GCPHASES);
+  for (i = 0; i < LUA_GCPHASES; i++) {
+    lua_pushnumber(L, stats.work[i]);
+    lua_setfield(L, -2, phases[i]);
+  }
+  lua_setfield(L, -2, "work");
+  lua_pushnumber(L, stats.cycles);
+  lua_setfield(L, -2, "cycles");
+  lua_pushnumber(L, stats.freed);
+  lua_setfield(L, -2, "freed");
+  lua_pushnumber(L, stats.lastfreed);
+  lua_setfield(L, -2, "lastfreed");
+  lua_pushnumber(L, stats.finalizers);
+  lua_setfield(L, -2, "finalizers");
+  lua_pushnumber(L, stats.maxpause);
+  lua_setfield(L, -2, "maxpause");
+  return 1;
+}
+
+
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "setpause", "setstepmul",
-    "setmajorinc", "isrunning", "generational", "incremental", NULL};
+    "setmajorinc", "isrunning", "generational", "incremental", "stepus",
+    "stats", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-    LUA_GCSETMAJORINC, LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC};
+    LUA_GCSETMAJORINC, LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC, LUA_GCSTEPUS,
+    GCSTATS};
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
   int ex = luaL_optint(L, 2, 0);
-  int res = lua_gc(L, o, ex);
+  int res;
+  if (o == GCSTATS)
+    return gcstats(L, ex);
+  res = lua_gc(L, o, ex);
   switch (o) {
     case LUA_GCCOUNT: {
       int b = lua_gc(L, LUA_GCCOUNTB, 0);
@@ -174,7 +216,7 @@ static int luaB_collectgarbage (lua_State *L) {
       lua_pushinteger(L, b);
       return 2;
     }
-    case LUA_GCSTEP: case LUA_GCISRUNNING: {
+    case LUA_GCSTEP: case LUA_GCSTEPUS: case LUA_GCISRUNNING: {
       lua_pushboolean(L, res);
       return 1;
     }
@@ -6,6 +6,7 @@
 
 
 #include <stdlib.h>
+#include <string.h>
 
 #define lcode_c
 #define LUA_CORE
@@ -879,3 +880,159 @@ void luaK_setlist (FuncState *fs, int base, int nelems, int tostore) {
   fs->freereg = base + 1;  /* free registers with list values */
 }
 
+
+
+/*
+** {======================================================
+** Optimizer
+** Optional pass over a finished function (see 'lua_optimize'). It
+** threads jumps through unconditional jumps (and turns jumps to a
+** return into the return itself), then removes unreachable
+** instructions, jumps to the next instruction and moves of a register
+** to itself, fixing jump offsets and debug information.
+** =======================================================
+*/
+
+
+/* does 'i' make the VM skip or consume the instruction after it? */
+static int usesnext (Instruction i) {
+  OpCode op = GET_OPCODE(i);
+  return (testTMode(op) || op == OP_TFORCALL || op == OP_LOADKX ||
+          (op == OP_LOADBOOL && GETARG_C(i)) ||
+          (op == OP_SETLIST && GETARG_C(i) == 0));
+}
+
+
+static int isjumpop (OpCode op) {
+  return (op == OP_JMP || op == OP_FORLOOP || op == OP_FORPREP ||
+          op == OP_TFORLOOP);
+}
+
+
+#define jumpdest(code,pc)	((pc) + 1 + GETARG_sBx((code)[pc]))
+
+
+/*
+** retarget each jump that lands on an unconditional jump without
+** upvalues to close to the final destination; a plain jump to a
+** return (not the jump of a test) becomes a copy of that return
+*/
+static void threadjumps (FuncState *fs) {
+  Instruction *code = fs->f->code;
+  int pc;
+  for (pc = 0; pc < fs->pc; pc++) {
+    int dest, n;
+    if (GET_OPCODE(code[pc]) != OP_JMP) continue;
+    dest = jumpdest(code, pc);
+    for (n = 0; n < fs->pc && GET_OPCODE(code[dest]) == OP_JMP &&
+                GETARG_A(code[dest]) == 0 && jumpdest(code, dest) != dest;
+         n++)
+      dest = jumpdest(code, dest);
+    if (GETARG_A(code[pc]) == 0 && GET_OPCODE(code[dest]) == OP_RETURN &&
+        !(pc > 0 && usesnext(code[pc - 1])))
+      code[pc] = code[dest];
+    else
+      SETARG_sBx(code[pc], dest - (pc + 1));
+  }
+}
+
+
+/* mark instructions reachable from the entry point */
+static void markreachable (FuncState *fs, lu_byte *live, int *stack) {
+  Instruction *code = fs->f->code;
+  int n = 0;
+  stack[n++] = 0;
+  live[0] = 1;
+  while (n > 0) {
+    int pc = stack[--n];
+    Instruction i = code[pc];
+    int succ[2], ns = 0, k;
+    switch (GET_OPCODE(i)) {
+      case OP_RETURN: break;
+      case OP_JMP: case OP_FORPREP:
+        succ[ns++] = jumpdest(code, pc); break;
+      case OP_FORLOOP: case OP_TFORLOOP:
+        succ[ns++] = pc + 1; succ[ns++] = jumpdest(code, pc); break;
+      case OP_LOADBOOL:
+        succ[ns++] = pc + (GETARG_C(i) ? 2 : 1); break;
+      default:
+        succ[ns++] = pc + 1;  /* (keeps EXTRAARG and TFORLOOP) */
+        if (testTMode(GET_OPCODE(i))) succ[ns++] = pc + 2;
+        break;
+    }
+    for (k = 0; k < ns; k++) {
+      if (succ[k] < fs->pc && !live[succ[k]]) {
+        live[succ[k]] = 1;
+        stack[n++] = succ[k];
+      }
+    }
+  }
+}
+
+
+/* can instruction 'pc' be removed, given what was kept before it? */
+static int removable (FuncState *fs, const lu_byte *live, int pc,
+                                      int prevkept) {
+  Instruction i = fs->f->code[pc];
+  if (prevkept >= 0 && prevkept == pc - 1 &&
+      usesnext(fs->f->code[prevkept]))
+    return 0;  /* the previous instruction depends on this one */
+  if (!live[pc]) return 1;
+  switch (GET_OPCODE(i)) {
+    case OP_JMP: return (GETARG_A(i) == 0 && GETARG_sBx(i) == 0);
+    case OP_MOVE: return (GETARG_A(i) == GETARG_B(i));
+    default: return 0;
+  }
+}
+
+
+void luaK_optimize (FuncState *fs) {
+  Dyndata *dyd = fs->ls->dyd;
+  Proto *f = fs->f;
+  Instruction *code = f->code;
+  int n = fs->pc;
+  size_t need = (n + 1) * sizeof(int) + n;
+  int *newpc, pc, nk, prevkept;
+  lu_byte *live;
+  threadjumps(fs);
+  if (dyd->opt.size < need) {  /* scratch space is owned by the parser, */
+    /* so an error (even in this allocation) cannot leak it */
+    luaM_reallocvector(fs->ls->L, dyd->opt.arr, dyd->opt.size, need, char);
+    dyd->opt.size = need;
+  }
+  newpc = (int *)dyd->opt.arr;  /* (also a work stack) */
+  live = (lu_byte *)(newpc + n + 1);
+  memset(live, 0, n);
+  markreachable(fs, live, newpc);
+  /* compute new position of each instruction */
+  for (pc = nk = 0, prevkept = -1; pc < n; pc++) {
+    newpc[pc] = nk;  /* a removed one maps to the next kept one */
+    if (removable(fs, live, pc, prevkept))
+      live[pc] = 0;
+    else {
+      live[pc] = 1;
+      prevkept = pc;
+      nk++;
+    }
+  }
+  newpc[n] = nk;
+  if (nk < n) {  /* anything removed? */
+    int i;
+    for (pc = 0; pc < n; pc++) {
+      if (!live[pc]) continue;
+      if (isjumpop(GET_OPCODE(code[pc]))) {
+        int dest = jumpdest(code, pc);
+        SETARG_sBx(code[pc], newpc[dest] - (newpc[pc] + 1));
+      }
+      code[newpc[pc]] = code[pc];
+      f->lineinfo[newpc[pc]] = f->lineinfo[pc];
+    }
+    for (i = 0; i < fs->nlocvars; i++) {
+      f->locvars[i].startpc = newpc[f->locvars[i].startpc];
+      f->locvars[i].endpc = newpc[f->locvars[i].endpc];
+    }
+    fs->pc = nk;
+  }
+}
+
+/* }====================================================== */
@@ -380,6 +380,46 @@ static int db_traceback (lua_State *L) {
 }
 
 
+/*
+** debug.opstats([reset]) returns two tables, indexed by opcode name, with
+** the number of executions and the estimated time of each opcode that
+** was executed; if 'reset' is true the counters are cleared afterwards.
+** Returns nil if Lua was built without LUAI_OPSTATS.
+*/
+static int db_opstats (lua_State *L) {
+  int reset = lua_toboolean(L, 1);
+  lua_Number count, ticks;
+  const char *name;
+  int op;
+  lua_newtable(L);  /* counts */
+  lua_newtable(L);  /* times */
+  for (op = 0; (name = lua_opstats(L, op, &count, &ticks)) != NULL; op++) {
+    if (count == 0) continue;
+    lua_pushnumber(L, count);
+    lua_setfield(L, -3, name);
+    lua_pushnumber(L, ticks);
+    lua_setfield(L, -2, name);
+  }
+  if (op == 0) {  /* no statistics? */
+    lua_pushnil(L);
+    return 1;
+  }
+  if (reset) lua_resetopstats(L);
+  return 2;
+}
+
+
+/*
+** debug.optimize([on]) returns whether the bytecode optimizer is on and,
+** if 'on' is given, turns it on or off for code compiled afterwards.
+*/
+static int db_optimize (lua_State *L) {
+  int on = lua_isnoneornil(L, 1) ? -1 : lua_toboolean(L, 1);
+  lua_pushboolean(L, lua_optimize(L, on));
+  return 1;
+}
+
+
 static const luaL_Reg dblib[] = {
   {"debug", db_debug},
   {"getuservalue", db_getuservalue},
@@ -388,6 +428,8 @@ static const luaL_Reg dblib[] = {
   {"getlocal", db_getlocal},
   {"getregistry", db_getregistry},
   {"getmetatable", db_getmetatable},
+  {"opstats", db_opstats},
+  {"optimize", db_optimize},
   {"getupvalue", db_getupvalue},
   {"upvaluejoin", db_upvaluejoin},
   {"upvalueid", db_upvalueid},
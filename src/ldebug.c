@@ -90,6 +90,80 @@ LUA_API int lua_gethookcount (lua_State *L) {
 }
 
 
+#if defined(LUAI_OPSTATS)
+void luaG_resetopstats (global_State *g) {
+  int op;
+  for (op = 0; op < NUM_OPCODES; op++) {
+    g->opcount[op] = 0;
+#if defined(LUAI_OPSTATS_TIME)
+    g->opticks[op] = g->opsamples[op] = 0;
+#endif
+  }
+#if defined(LUAI_OPSTATS_TIME)
+  g->opsampled = -1;
+  g->opclock = LUAI_OPSTATS_RATE;
+#endif
+}
+#endif
+
+
+/*
+** returns the name of opcode 'op' and how many times it was executed;
+** 'ticks' gets the estimated total time spent in it (0 when time is
+** not sampled). Returns NULL for an invalid opcode and when Lua was
+** built without LUAI_OPSTATS.
+*/
+LUA_API const char *lua_opstats (lua_State *L, int op, lua_Number *count,
+                                                       lua_Number *ticks) {
+#if defined(LUAI_OPSTATS)
+  global_State *g = G(L);
+  if (op < 0 || op >= NUM_OPCODES)
+    return NULL;
+  lua_lock(L);
+  if (count) *count = cast_num(g->opcount[op]);
+  if (ticks) {
+#if defined(LUAI_OPSTATS_TIME)
+    lu_mem samples = g->opsamples[op];
+    *ticks = (samples == 0) ? 0 :
+       cast_num(g->opticks[op]) / cast_num(samples) * cast_num(g->opcount[op]);
+#else
+    *ticks = 0;
+#endif
+  }
+  lua_unlock(L);
+  return luaP_opnames[op];
+#else
+  UNUSED(L); UNUSED(op); UNUSED(count); UNUSED(ticks);
+  return NULL;
+#endif
+}
+
+
+LUA_API void lua_resetopstats (lua_State *L) {
+#if defined(LUAI_OPSTATS)
+  lua_lock(L);
+  luaG_resetopstats(G(L));
+  lua_unlock(L);
+#else
+  UNUSED(L);
+#endif
+}
+
+
+/*
+** turns the bytecode optimizer on or off for functions compiled from
+** now on ('on' < 0 leaves it unchanged); returns the previous setting
+*/
+LUA_API int lua_optimize (lua_State *L, int on) {
+  int old;
+  lua_lock(L);
+  old = G(L)->optimize;
+  if (on >= 0) G(L)->optimize = cast_byte(on != 0);
+  lua_unlock(L);
+  return old;
+}
+
+
 LUA_API int lua_getstack (lua_State *L, int level, lua_Debug *ar) {
   int status;
   CallInfo *ci;
@@ -30,5 +30,8 @@ LUAI_FUNC l_noret luaG_ordererror (lua_State *L, const TValue *p1,
                                                  const TValue *p2);
 LUAI_FUNC l_noret luaG_runerror (lua_State *L, const char *fmt, ...);
 LUAI_FUNC l_noret luaG_errormsg (lua_State *L);
+#if defined(LUAI_OPSTATS)
+LUAI_FUNC void luaG_resetopstats (global_State *g);
+#endif
 
 #endif
@@ -5,6 +5,7 @@
 */
 
 #include <string.h>
+#include <time.h>
 
 #define lgc_c
 #define LUA_CORE
@@ -37,6 +38,27 @@
 #define GCFINALIZENUM	4
 
 
+/* number of single steps between clock checks in 'luaC_timedstep' */
+#define GCCLOCKSTEPS	16
+
+
+/*
+** luai_gcclock returns a time in microseconds for 'luaC_timedstep'
+** and for the collector statistics
+*/
+#if !defined(luai_gcclock)
+#if defined(LUA_USE_POSIX) && defined(CLOCK_MONOTONIC)
+static lua_Number luai_gcclock (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return cast_num(ts.tv_sec) * 1e6 + cast_num(ts.tv_nsec) / 1e3;
+}
+#else
+#define luai_gcclock()	(cast_num(clock()) * 1e6 / CLOCKS_PER_SEC)
+#endif
+#endif
+
+
 /*
 ** macro to adjust 'stepmul': 'stepmul' is actually used like
 ** 'stepmul / STEPMULADJ' (value chosen by tests)
@@ -468,6 +490,7 @@ static int traverseproto (global_State *g, Proto *f) {
   for (i = 0; i < f->sizelocvars; i++)  /* mark local-variable names */
     markobject(g, f->locvars[i].varname);
   return sizeof(Proto) + sizeof(Instruction) * f->sizecode +
+                         (f->icache ? sizeof(int) * f->sizecode : 0) +
                          sizeof(Proto *) * f->sizep +
                          sizeof(TValue) * f->sizek +
                          sizeof(int) * f->sizelineinfo +
@@ -818,6 +841,7 @@ static void GCTM (lua_State *L, int propagateerrors) {
     int running  = g->gcrunning;
     L->allowhook = 0;  /* stop debug hooks during GC metamethod */
     g->gcrunning = 0;  /* avoid GC steps */
+    g->gcstats.finalizers++;
     setobj2s(L, L->top, tm);  /* push finalizer... */
     setobj2s(L, L->top + 1, &v);  /* ... and its argument */
     L->top += 2;  /* and (next line) call the finalizer */
@@ -986,6 +1010,8 @@ void luaC_freeallobjects (lua_State *L) {
   separatetobefnz(L, 1);  /* separate all objects with finalizers */
   lua_assert(g->finobj == NULL);
   callallpendingfinalizers(L, 0);
+  if (g->bulkfree)  /* allocator will release all memory at once? */
+    return;  /* no need to free objects one by one */
   g->currentwhite = WHITEBITS; /* this "white" makes all objects look dead */
   g->gckind = KGC_NORMAL;
   sweepwholelist(L, &g->finobj);  /* finalizers can create objs. in 'finobj' */
@@ -1037,7 +1063,86 @@ static l_mem atomic (lua_State *L) {
 }
 
 
-static lu_mem singlestep (lua_State *L) {
+/*
+** {======================================================
+** Statistics
+** =======================================================
+*/
+
+/*
+** starts timing a collector step; returns false (and does nothing) if a
+** step is already being timed, as when a step runs a full collection
+*/
+static int stepbegin (global_State *g) {
+  if (g->gctiming) return 0;
+  g->gctiming = 1;
+  g->gcstepstart = g->gcmark = luai_gcclock();
+  return 1;
+}
+
+
+/*
+** maps a collector state to the phase of the statistics it belongs to
+** (the restart done in 'GCSpause' is charged to propagation)
+*/
+static int gcphase (int state) {
+  switch (state) {
+    case GCSpause: case GCSpropagate: return LUA_GCPPROPAGATE;
+    case GCSatomic: return LUA_GCPATOMIC;
+    case GCSsweepstring: return LUA_GCPSWEEPSTRING;
+    case GCSsweepudata: return LUA_GCPSWEEPUDATA;
+    case GCSsweep: return LUA_GCPSWEEP;
+    default: lua_assert(0); return LUA_GCPPROPAGATE;
+  }
+}
+
+
+/* charges the time since the last mark to 'phase' (a LUA_GCP* value) */
+static void chargephase (global_State *g, int phase) {
+  if (g->gctiming) {
+    lua_Number now = luai_gcclock();
+    g->gcstats.time[phase] += now - g->gcmark;
+    g->gcmark = now;
+  }
+}
+
+
+/* ends the timing of a step started by 'stepbegin' (if 'timed') */
+static void stepend (global_State *g, int timed) {
+  if (timed) {
+    lua_Number pause = luai_gcclock() - g->gcstepstart;
+    if (pause > g->gcstats.maxpause)
+      g->gcstats.maxpause = pause;
+    g->gctiming = 0;
+  }
+}
+
+
+/*
+** calls all pending finalizers outside the timing of the current step,
+** if any (a full collection run by a generational step): an error in a
+** finalizer must not leave a step open, and their time is not a pause
+*/
+static void untimedfinalizers (lua_State *L) {
+  global_State *g = G(L);
+  if (g->gctiming) {
+    lua_Number start;
+    chargephase(g, gcphase(g->gcstate));
+    g->gctiming = 0;
+    start = luai_gcclock();
+    callallpendingfinalizers(L, 1);
+    g->gcmark = luai_gcclock();
+    g->gcstepstart += g->gcmark - start;
+    g->gctiming = 1;
+  }
+  else
+    callallpendingfinalizers(L, 1);
+}
+
+/* }====================================================== */
+
+
+static lu_mem runstep (lua_State *L) {
   global_State *g = G(L);
   switch (g->gcstate) {
     case GCSpause: {
@@ -1057,6 +1162,7 @@ static lu_mem singlestep (lua_State *L) {
       else {  /* no more `gray' objects */
         lu_mem work;
         int sw;
+        chargephase(g, LUA_GCPPROPAGATE);
         g->gcstate = GCSatomic;  /* finish mark phase */
         g->GCestimate = g->GCmemtrav;  /* save what was counted */;
         work = atomic(L);  /* add what was traversed by 'atomic' */
@@ -1103,6 +1209,34 @@ static lu_mem singlestep (lua_State *L) {
 }
 
 
+/*
+** performs one step of the collector, accounting for its work, its time
+** (when a phase ends) and the memory it frees
+*/
+static lu_mem singlestep (lua_State *L) {
+  global_State *g = G(L);
+  int state = g->gcstate;
+  int phase = gcphase(state);
+  lu_mem before = gettotalbytes(g);
+  lu_mem work = runstep(L);
+  if (state == GCSpropagate && g->gcstate != GCSpropagate)
+    phase = LUA_GCPATOMIC;  /* this step ran 'atomic' */
+  if (gettotalbytes(g) < before)
+    g->gccyclefreed += before - gettotalbytes(g);
+  g->gcstats.work[phase] += cast_num(work);
+  if (g->gcstate != state) {  /* phase changed? */
+    chargephase(g, phase);
+    if (g->gcstate == GCSpause) {  /* cycle completed? */
+      g->gcstats.cycles++;
+      g->gcstats.freed += cast_num(g->gccyclefreed);
+      g->gcstats.lastfreed = cast_num(g->gccyclefreed);
+      g->gccyclefreed = 0;
+    }
+  }
+  return work;
+}
+
+
 /*
 ** advances the garbage collector until it reaches a state allowed
 ** by 'statemask'
@@ -1162,15 +1296,59 @@ static void incstep (lua_State *L) {
 */
 void luaC_forcestep (lua_State *L) {
   global_State *g = G(L);
+  int timed = stepbegin(g);
   int i;
   if (isgenerational(g)) generationalcollection(L);
   else incstep(L);
+  chargephase(g, gcphase(g->gcstate));
+  stepend(g, timed);  /* finalizers are not part of the step */
   /* run a few finalizers (or all of them at the end of a collect cycle) */
   for (i = 0; g->tobefnz && (i < GCFINALIZENUM || g->gcstate == GCSpause); i++)
     GCTM(L, 1);  /* call one finalizer */
 }
 
 
+/*
+** performs single steps (and then finalizers) until 'us' microseconds
+** have passed or the current cycle ends; the work done is discounted
+** from the debt. Returns true if a cycle was completed. In generational
+** mode it performs a regular step, which runs a whole (minor or major)
+** collection unless the collector is in the middle of a cycle.
+*/
+int luaC_timedstep (lua_State *L, int us) {
+  global_State *g = G(L);
+  lua_Number deadline = luai_gcclock() + us;
+  int stepmul = g->gcstepmul;
+  lu_mem work = 0;
+  int n = 0;
+  int timed;
+  if (isgenerational(g)) {
+    lua_Number cycles = g->gcstats.cycles;
+    luaC_forcestep(L);
+    return (g->gcstats.cycles != cycles);
+  }
+  timed = stepbegin(g);
+  if (stepmul < 40) stepmul = 40;  /* as in 'incstep' */
+  do {
+    work += singlestep(L);
+  } while (g->gcstate != GCSpause &&
+           (++n % GCCLOCKSTEPS != 0 || luai_gcclock() < deadline));
+  if (g->gcstate == GCSpause)
+    setpause(g, g->GCestimate);  /* pause until next cycle */
+  else {  /* convert 'work units' to Kb and pay them */
+    l_mem paid = cast(l_mem, (work / stepmul) * STEPMULADJ);
+    luaE_setdebt(g, g->GCdebt - ((paid > 0) ? paid : 0));
+  }
+  chargephase(g, gcphase(g->gcstate));
+  stepend(g, timed);
+  /* run finalizers while there is time (all of them at the end of cycle) */
+  while (g->tobefnz &&
+         (g->gcstate == GCSpause || luai_gcclock() < deadline))
+    GCTM(L, 1);
+  return (g->gcstate == GCSpause);
+}
+
+
 /*
 ** performs a basic GC step only if collector is running
 */
@@ -1189,13 +1367,15 @@ void luaC_step (lua_State *L) {
 void luaC_fullgc (lua_State *L, int isemergency) {
   global_State *g = G(L);
   int origkind = g->gckind;
+  int timed;
   lua_assert(origkind != KGC_EMERGENCY);
   if (isemergency)  /* do not run finalizers during emergency GC */
     g->gckind = KGC_EMERGENCY;
   else {
     g->gckind = KGC_NORMAL;
-    callallpendingfinalizers(L, 1);
+    untimedfinalizers(L);
   }
+  timed = stepbegin(g);
   if (keepinvariant(g)) {  /* may there be some black objects? */
     /* must sweep all objects to turn them back to white
        (as white has not changed, nothing will be collected) */
@@ -1211,8 +1391,10 @@ void luaC_fullgc (lua_State *L, int isemergency) {
   }
   g->gckind = origkind;
   setpause(g, gettotalbytes(g));
+  chargephase(g, gcphase(g->gcstate));
+  stepend(g, timed);
   if (!isemergency)   /* do not run finalizers during emergency GC */
-    callallpendingfinalizers(L, 1);
+    untimedfinalizers(L);
 }
 
 /* }====================================================== */
@@ -34,7 +34,8 @@
 
 
 /*
-** Possible states of the Garbage Collector
+** Possible states of the Garbage Collector (the phases reported in
+** 'lua_GCStats', LUA_GCP* in lua.h, are mapped from them by 'gcphase')
 */
 #define GCSpropagate	0
 #define GCSatomic	1
@@ -143,6 +144,7 @@
 LUAI_FUNC void luaC_freeallobjects (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
 LUAI_FUNC void luaC_forcestep (lua_State *L);
+LUAI_FUNC int luaC_timedstep (lua_State *L, int us);
 LUAI_FUNC void luaC_runtilstate (lua_State *L, int statesmask);
 LUAI_FUNC void luaC_fullgc (lua_State *L, int isemergency);
 LUAI_FUNC GCObject *luaC_newobj (lua_State *L, int tt, size_t sz,
@@ -46,6 +46,7 @@ static const luaL_Reg loadedlibs[] = {
 ** these libs are preloaded and must be required before used
 */
 static const luaL_Reg preloadedlibs[] = {
+  {LUA_PROFLIBNAME, luaopen_profile},
   {NULL, NULL}
 };
 
@@ -85,6 +85,10 @@ typedef struct Dyndata {
   } actvar;
   Labellist gt;  /* list of pending gotos */
   Labellist label;   /* list of active labels */
+  struct {  /* scratch space for 'luaK_optimize' */
+    char *arr;
+    size_t size;
+  } opt;
 } Dyndata;
 
 
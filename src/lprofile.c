@@ -0,0 +1,769 @@
+/*
+** Sampling profiler library
+** See Copyright Notice in lua.h
+*/
+
+/*
+** A timer signal (SIGPROF, measuring CPU time) installs a count hook
+** of one instruction on the profiled thread; 'lua_sethook' is safe to
+** call from a signal handler. The hook removes itself again and records
+** the call stack of the thread into a preallocated ring of samples. Full
+** rings are folded into a table of stacks, which 'profile.folded' turns
+** into the folded format used by flame graph tools:
+**
+**   main chunk (test.lua:0);update (test.lua:12);move (test.lua:3) 42
+**
+** Frames are attributed per function prototype (C function), named the
+** first time they are seen. As samples are taken by a hook, time spent
+** inside a C function is charged to the Lua function that called it.
+** Hooks are per thread, so only the thread that called 'profile.start'
+** is sampled. A tick arriving while a coroutine runs leaves its sample
+** pending until control returns to that thread, where it is charged to
+** the call to 'resume'; later ticks are dropped meanwhile, so a coroutine
+** running for long counts as a single sample per resume.
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#define lprofile_c
+#define LUA_LIB
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+#include "ldebug.h"
+#include "lobject.h"
+#include "lstate.h"
+
+#if defined(LUA_USE_POSIX)
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+
+#define PROF_MAXDEPTH	64	/* frames kept per sample */
+#define PROF_RINGSIZE	256	/* samples kept before folding them */
+
+#define PROF_DEFINTERVAL	0.001	/* default sampling interval (seconds) */
+
+/* fields of the uservalue table of the profiler */
+#define PROF_IDS	1	/* frame key -> frame id */
+#define PROF_NAMES	2	/* frame id -> frame name */
+#define PROF_FUNCS	3	/* frame id -> function (keeps protos alive) */
+#define PROF_STACKS	4	/* folded stack -> number of samples */
+#define PROF_THREAD	5	/* the profiled thread */
+
+#define PROF_TNAME	"profile.state"
+
+
+typedef struct Sample {
+  int depth;  /* number of frames in 'frame' */
+  int frame[PROF_MAXDEPTH];  /* frame ids, innermost first */
+} Sample;
+
+
+typedef struct Profiler {
+  lua_State *L;  /* thread being profiled */
+  lua_Hook oldhook;  /* hook replaced by a pending sample */
+  int oldmask;
+  int oldcount;
+  volatile int pending;  /* is a sample hook installed? */
+  int running;
+  int nring;  /* number of samples in 'ring' */
+  int nframes;  /* number of known frames */
+  lua_Number samples;  /* total number of samples taken */
+  Sample ring[PROF_RINGSIZE];
+} Profiler;
+
+
+/* profiler receiving timer signals (at most one per process) */
+static Profiler *volatile active = NULL;
+
+/* key of the profiler of a state in the registry */
+static const char profkey = 'p';
+
+
+/* pushes the profiler's uservalue field 'i' */
+static void getfield (lua_State *L, int ud, int i) {
+  lua_getuservalue(L, ud);
+  lua_rawgeti(L, -1, i);
+  lua_remove(L, -2);
+}
+
+
+/* folds the samples in the ring into the table of stacks */
+static void fold (lua_State *L, Profiler *p, int ud) {
+  int names, stacks;
+  int i, j;
+  getfield(L, ud, PROF_NAMES);
+  names = lua_gettop(L);
+  getfield(L, ud, PROF_STACKS);
+  stacks = lua_gettop(L);
+  for (i = 0; i < p->nring; i++) {
+    Sample *s = &p->ring[i];
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    for (j = s->depth - 1; j >= 0; j--) {  /* outermost frame first */
+      lua_rawgeti(L, names, s->frame[j]);
+      luaL_addvalue(&b);
+      if (j > 0) luaL_addchar(&b, ';');
+    }
+    luaL_pushresult(&b);
+    lua_pushvalue(L, -1);
+    lua_rawget(L, stacks);
+    lua_pushnumber(L, lua_tonumber(L, -1) + 1);
+    lua_remove(L, -2);
+    lua_rawset(L, stacks);
+  }
+  lua_pop(L, 2);
+  p->nring = 0;
+}
+
+
+/* pushes the profiler of the state, or nil */
+static Profiler *getprofiler (lua_State *L) {
+  lua_rawgetp(L, LUA_REGISTRYINDEX, &profkey);
+  return (Profiler *)lua_touserdata(L, -1);
+}
+
+
+#if defined(LUA_USE_POSIX)
+
+static struct sigaction oldaction;
+
+
+/*
+** returns the id of the frame running at 'ci' (which is at 'level' of
+** the stack), registering it if this is the first time it is seen.
+** Expects the tables of ids, names and functions on the stack top.
+*/
+static int frameid (lua_State *L, Profiler *p, CallInfo *ci, int level) {
+  const TValue *func = ci->func;
+  const void *key;
+  int id;
+  if (ttisLclosure(func)) key = clLvalue(func)->p;
+  else if (ttislcf(func)) key = cast(void *, fvalue(func));
+  else key = cast(void *, clCvalue(func)->f);
+  lua_rawgetp(L, -3, key);
+  id = cast_int(lua_tointeger(L, -1));
+  lua_pop(L, 1);
+  if (id == 0) {  /* new frame? */
+    lua_Debug ar;
+    id = ++p->nframes;
+    lua_pushinteger(L, id);
+    lua_rawsetp(L, -4, key);
+    lua_getstack(L, level, &ar);
+    lua_getinfo(L, "Snf", &ar);
+    lua_rawseti(L, -2, id);  /* anchor function */
+    if (*ar.what == 'C')
+      lua_pushfstring(L, "%s [C]", ar.name ? ar.name : "?");
+    else
+      lua_pushfstring(L, "%s (%s:%d)",
+                      ar.name ? ar.name :
+                      (*ar.what == 'm' ? "main chunk" : "?"),
+                      ar.short_src, ar.linedefined);
+    lua_rawseti(L, -3, id);
+  }
+  return id;
+}
+
+
+static void sample (lua_State *L, Profiler *p) {
+  CallInfo *ci;
+  Sample *s;
+  int level = 0;
+  int ud;
+  getprofiler(L);
+  ud = lua_gettop(L);
+  if (p->nring == PROF_RINGSIZE)
+    fold(L, p, ud);
+  s = &p->ring[p->nring];
+  s->depth = 0;
+  getfield(L, ud, PROF_IDS);
+  getfield(L, ud, PROF_NAMES);
+  getfield(L, ud, PROF_FUNCS);
+  for (ci = L->ci; ci != &L->base_ci && s->depth < PROF_MAXDEPTH;
+       ci = ci->previous)
+    s->frame[s->depth++] = frameid(L, p, ci, level++);
+  lua_settop(L, ud - 1);
+  p->nring++;
+  p->samples++;
+}
+
+
+static void hook (lua_State *L, lua_Debug *ar) {
+  Profiler *p = active;
+  (void)ar;
+  if (p == NULL || p->L != L || !p->pending) return;
+  lua_sethook(L, p->oldhook, p->oldmask, p->oldcount);  /* remove itself */
+  p->pending = 0;
+  sample(L, p);
+}
+
+
+static void handler (int sig) {
+  Profiler *p = active;
+  (void)sig;
+  if (p != NULL && !p->pending) {
+    p->oldhook = lua_gethook(p->L);
+    p->oldmask = lua_gethookmask(p->L);
+    p->oldcount = lua_gethookcount(p->L);
+    p->pending = 1;
+    lua_sethook(p->L, hook, LUA_MASKCOUNT, 1);
+  }
+}
+
+
+static int settimer (lua_State *L, double interval) {
+  struct itimerval it;
+  it.it_interval.tv_sec = (time_t)interval;
+  it.it_interval.tv_usec = (suseconds_t)((interval - (time_t)interval) * 1e6);
+  it.it_value = it.it_interval;
+  if (interval > 0) {
+    struct sigaction sa;
+    sa.sa_handler = handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, &oldaction) != 0)
+      return luaL_error(L, "cannot install profiling signal handler");
+  }
+  if (setitimer(ITIMER_PROF, &it, NULL) != 0)
+    return luaL_error(L, "cannot set profiling timer");
+  if (interval <= 0)
+    sigaction(SIGPROF, &oldaction, NULL);
+  return 0;
+}
+
+#else
+
+static int settimer (lua_State *L, double interval) {
+  (void)interval;
+  return luaL_error(L, "profiling not supported on this platform");
+}
+
+#endif
+
+
+/* stops the profiler 'p' if it is running */
+static void stop (lua_State *L, Profiler *p) {
+  if (p->running) {
+    settimer(L, 0);
+    active = NULL;
+    p->running = 0;
+    if (p->pending) {  /* remove pending sample hook */
+      lua_sethook(p->L, p->oldhook, p->oldmask, p->oldcount);
+      p->pending = 0;
+    }
+  }
+}
+
+
+static int prof_gc (lua_State *L) {
+  stop(L, (Profiler *)luaL_checkudata(L, 1, PROF_TNAME));
+  return 0;
+}
+
+
+/* creates the profiler of the state, with empty data */
+static Profiler *newprofiler (lua_State *L) {
+  Profiler *p = (Profiler *)lua_newuserdata(L, sizeof(Profiler));
+  int i;
+  memset(p, 0, sizeof(Profiler) - sizeof(p->ring));
+  luaL_setmetatable(L, PROF_TNAME);
+  lua_createtable(L, PROF_THREAD, 0);
+  for (i = PROF_IDS; i <= PROF_STACKS; i++) {
+    lua_newtable(L);
+    lua_rawseti(L, -2, i);
+  }
+  lua_setuservalue(L, -2);
+  lua_pushvalue(L, -1);
+  lua_rawsetp(L, LUA_REGISTRYINDEX, &profkey);
+  return p;
+}
+
+
+static int prof_start (lua_State *L) {
+  lua_Number interval = luaL_optnumber(L, 1, PROF_DEFINTERVAL);
+  Profiler *p = getprofiler(L);
+  luaL_argcheck(L, interval > 0, 1, "interval must be positive");
+  if (p == NULL) p = newprofiler(L);
+  if (active != NULL)
+    return luaL_error(L, "profiler already running");
+  p->L = L;
+  lua_getuservalue(L, -1);
+  lua_pushthread(L);
+  lua_rawseti(L, -2, PROF_THREAD);  /* anchor profiled thread */
+  active = p;
+  p->running = 1;
+  settimer(L, interval);
+  return 0;
+}
+
+
+static int prof_stop (lua_State *L) {
+  Profiler *p = getprofiler(L);
+  if (p == NULL) return 0;
+  stop(L, p);
+  lua_pushnumber(L, p->samples);
+  return 1;
+}
+
+
+static int prof_reset (lua_State *L) {
+  Profiler *p = getprofiler(L);
+  if (p != NULL) {
+    stop(L, p);
+    lua_pushnil(L);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &profkey);
+  }
+  return 0;
+}
+
+
+static int cmpstack (const void *a, const void *b) {
+  return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+
+static int prof_folded (lua_State *L) {
+  Profiler *p = getprofiler(L);
+  luaL_Buffer b;
+  const char **list;  /* sorted stacks (anchored as keys of 'stacks') */
+  int stacks;
+  int i, n = 0;
+  if (p == NULL) {
+    lua_pushliteral(L, "");
+    return 1;
+  }
+  fold(L, p, lua_gettop(L));
+  getfield(L, -1, PROF_STACKS);
+  stacks = lua_gettop(L);
+  lua_pushnil(L);
+  while (lua_next(L, stacks)) {
+    lua_pop(L, 1);
+    n++;
+  }
+  list = (const char **)lua_newuserdata(L, n * sizeof(const char *));
+  i = 0;
+  lua_pushnil(L);
+  while (lua_next(L, stacks)) {
+    lua_pop(L, 1);
+    list[i++] = lua_tostring(L, -1);
+  }
+  qsort(list, n, sizeof(const char *), cmpstack);
+  luaL_buffinit(L, &b);
+  for (i = 0; i < n; i++) {
+    lua_pushstring(L, list[i]);
+    lua_rawget(L, stacks);
+    lua_pushfstring(L, "%s %d\n", list[i], (int)lua_tointeger(L, -1));
+    lua_remove(L, -2);
+    luaL_addvalue(&b);
+  }
+  luaL_pushresult(&b);
+  return 1;
+}
+
+
+/*
+** {======================================================
+** Allocation profiler
+** =======================================================
+*/
+
+/*
+** The allocator of the state is wrapped by 'memalloc'. About one byte
+** in every 'rate' allocated is sampled: the allocation containing it
+** is charged to the source line of the innermost Lua function of the
+** running thread, with a weight of 'rate' bytes (or its real size, if
+** larger). Sampled blocks are remembered until they are freed, so each
+** site has an estimate of the live heap it holds besides the total it
+** has allocated. The profiler's own memory comes directly from the
+** wrapped allocator and is not seen by the collector.
+*/
+
+#define MEM_DEFRATE	(16 * 1024)	/* default sampling rate (bytes) */
+#define MEM_NSITEBUCKETS	1024	/* size of hash of sites */
+#define MEM_MINBLOCKS	64	/* initial size of hash of sampled blocks */
+
+#define MEM_TNAME	"profile.memory"
+
+
+typedef struct AllocSite {
+  struct AllocSite *next;  /* next site in the same bucket */
+  unsigned int hash;
+  int line;
+  size_t live;  /* estimated bytes still allocated */
+  size_t total;  /* estimated bytes ever allocated */
+  size_t nlive;  /* number of live sampled blocks */
+  size_t ntotal;  /* number of sampled blocks */
+  char source[LUA_IDSIZE];
+} AllocSite;
+
+
+typedef struct AllocBlock {
+  void *ptr;  /* sampled block (NULL for empty slots) */
+  AllocSite *site;
+  size_t weight;
+} AllocBlock;
+
+
+typedef struct AllocProfiler {
+  lua_Alloc f;  /* wrapped allocator */
+  void *ud;
+  lua_State *L;  /* main thread */
+  size_t rate;
+  size_t countdown;  /* bytes until the next sample */
+  AllocBlock *blocks;  /* open addressing hash of sampled blocks */
+  size_t nblocks;
+  size_t sizeblocks;
+  AllocSite *sites[MEM_NSITEBUCKETS];
+} AllocProfiler;
+
+
+static void *memalloc (void *ud, void *ptr, size_t osize, size_t nsize);
+
+
+static size_t hashptr (const AllocProfiler *ap, const void *ptr) {
+  size_t h = (size_t)ptr;
+  return ((h >> 4) ^ (h >> 12)) & (ap->sizeblocks - 1);
+}
+
+
+/* removes the record of block 'ptr', if it was sampled */
+static void forget (AllocProfiler *ap, void *ptr) {
+  size_t i, j;
+  if (ap->nblocks == 0) return;
+  for (i = hashptr(ap, ptr); ap->blocks[i].ptr != ptr;
+       i = (i + 1) & (ap->sizeblocks - 1))
+    if (ap->blocks[i].ptr == NULL) return;  /* not sampled */
+  ap->blocks[i].site->live -= ap->blocks[i].weight;
+  ap->blocks[i].site->nlive--;
+  ap->nblocks--;
+  /* close the gap, moving back entries that probed past it */
+  for (j = (i + 1) & (ap->sizeblocks - 1); ap->blocks[j].ptr != NULL;
+       j = (j + 1) & (ap->sizeblocks - 1)) {
+    size_t h = hashptr(ap, ap->blocks[j].ptr);
+    if (((j - h) & (ap->sizeblocks - 1)) >= ((j - i) & (ap->sizeblocks - 1))) {
+      ap->blocks[i] = ap->blocks[j];
+      i = j;
+    }
+  }
+  ap->blocks[i].ptr = NULL;
+}
+
+
+static void insertblock (AllocProfiler *ap, const AllocBlock *b) {
+  size_t i = hashptr(ap, b->ptr);
+  while (ap->blocks[i].ptr != NULL)
+    i = (i + 1) & (ap->sizeblocks - 1);
+  ap->blocks[i] = *b;
+  ap->nblocks++;
+}
+
+
+/* keeps the hash of blocks at most half full; returns 0 on failure */
+static int growblocks (AllocProfiler *ap) {
+  AllocBlock *old = ap->blocks;
+  size_t oldsize = ap->sizeblocks;
+  size_t i, size = oldsize ? 2 * oldsize : MEM_MINBLOCKS;
+  AllocBlock *nb;
+  if (2 * (ap->nblocks + 1) <= oldsize) return 1;
+  nb = (AllocBlock *)ap->f(ap->ud, NULL, 0, size * sizeof(AllocBlock));
+  if (nb == NULL) return 0;
+  memset(nb, 0, size * sizeof(AllocBlock));
+  ap->blocks = nb;
+  ap->sizeblocks = size;
+  ap->nblocks = 0;
+  for (i = 0; i < oldsize; i++)
+    if (old[i].ptr != NULL) insertblock(ap, &old[i]);
+  if (old) ap->f(ap->ud, old, oldsize * sizeof(AllocBlock), 0);
+  return 1;
+}
+
+
+/*
+** finds (or creates) the site for the current allocation: the line being
+** executed by the innermost Lua function of the running thread. When the
+** allocation moves the stack of that thread ('old'), its frames point to
+** the old stack and cannot be read, so it is charged to a site of its own.
+*/
+static AllocSite *getsite (AllocProfiler *ap, const void *old) {
+  lua_State *L = G(ap->L)->running;
+  CallInfo *ci = L->ci;
+  char source[LUA_IDSIZE];
+  int line = 0;
+  unsigned int h;
+  const char *c;
+  AllocSite *site;
+  if (old != NULL && old == L->stack)
+    ci = &L->base_ci;
+  while (ci != &L->base_ci && !isLua(ci))
+    ci = ci->previous;
+  if (ci == &L->base_ci)
+    strcpy(source, (old != NULL && old == L->stack) ? "[stack]" : "[C]");
+  else {
+    Proto *p = ci_func(ci)->p;
+    int pc = pcRel(ci->u.l.savedpc, p);
+    if (pc >= 0 && pc < p->sizelineinfo)
+      line = getfuncline(p, pc);
+    luaO_chunkid(source, p->source ? getstr(p->source) : "=?", LUA_IDSIZE);
+  }
+  h = cast(unsigned int, line);
+  for (c = source; *c; c++)
+    h ^= ((h << 5) + (h >> 2) + cast(unsigned char, *c));
+  for (site = ap->sites[h % MEM_NSITEBUCKETS]; site; site = site->next)
+    if (site->hash == h && site->line == line &&
+        strcmp(site->source, source) == 0)
+      return site;
+  site = (AllocSite *)ap->f(ap->ud, NULL, 0, sizeof(AllocSite));
+  if (site == NULL) return NULL;
+  memset(site, 0, sizeof(AllocSite));
+  site->hash = h;
+  site->line = line;
+  strcpy(site->source, source);
+  site->next = ap->sites[h % MEM_NSITEBUCKETS];
+  ap->sites[h % MEM_NSITEBUCKETS] = site;
+  return site;
+}
+
+
+static void record (AllocProfiler *ap, const void *old, void *ptr,
+                    size_t size) {
+  AllocBlock b;
+  b.site = getsite(ap, old);
+  if (b.site == NULL || !growblocks(ap)) return;  /* skip sample */
+  b.ptr = ptr;
+  b.weight = (size < ap->rate) ? ap->rate : size;
+  b.site->live += b.weight;
+  b.site->total += b.weight;
+  b.site->nlive++;
+  b.site->ntotal++;
+  insertblock(ap, &b);
+}
+
+
+static void *memalloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  AllocProfiler *ap = (AllocProfiler *)ud;
+  void *nptr = ap->f(ap->ud, ptr, osize, nsize);
+  if (ptr != NULL && (nptr != NULL || nsize == 0))  /* old block gone? */
+    forget(ap, ptr);
+  if (nptr != NULL && nsize > 0) {
+    if (nsize < ap->countdown)
+      ap->countdown -= nsize;
+    else {  /* this block holds a sampled byte */
+      ap->countdown = ap->rate - (nsize - ap->countdown) % ap->rate;
+      record(ap, ptr, nptr, nsize);
+    }
+  }
+  return nptr;
+}
+
+
+/* gets the allocation profiler of a state, if it is installed */
+static AllocProfiler *getmemprofiler (lua_State *L) {
+  void *ud;
+  return (lua_getallocf(L, &ud) == memalloc) ? (AllocProfiler *)ud : NULL;
+}
+
+
+static void freememprofiler (AllocProfiler *ap) {
+  lua_Alloc f = ap->f;
+  void *ud = ap->ud;
+  int i;
+  for (i = 0; i < MEM_NSITEBUCKETS; i++) {
+    AllocSite *site = ap->sites[i];
+    while (site != NULL) {
+      AllocSite *next = site->next;
+      f(ud, site, sizeof(AllocSite), 0);
+      site = next;
+    }
+  }
+  if (ap->blocks) f(ud, ap->blocks, ap->sizeblocks * sizeof(AllocBlock), 0);
+  f(ud, ap, sizeof(AllocProfiler), 0);
+}
+
+
+/* key of the anchor of the allocation profiler in the registry */
+static const char memkey = 'm';
+
+
+static AllocProfiler **getmemanchor (lua_State *L) {
+  AllocProfiler **box;
+  lua_rawgetp(L, LUA_REGISTRYINDEX, &memkey);
+  box = (AllocProfiler **)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  return box;
+}
+
+
+/* uninstalls the profiler in 'box'; fails if it is not the allocator */
+static int removememprofiler (lua_State *L, AllocProfiler **box) {
+  if (*box != NULL) {
+    if (getmemprofiler(L) != *box)
+      return 0;  /* another allocator was installed over it */
+    lua_setallocf(L, (*box)->f, (*box)->ud);
+    freememprofiler(*box);
+    *box = NULL;
+  }
+  return 1;
+}
+
+
+/*
+** Starts sampling one in every 'rate' bytes allocated by the state
+** (restarting with empty statistics if it was running), or stops the
+** allocation profiler if 'rate' is 0. Returns 0 on failure: lack of
+** memory, or another allocator was installed over the profiler's.
+** Allocations are charged to the thread in 'G(L)->running', which only
+** 'lua_resume' updates: allocations of a coroutine driven by other means
+** are charged to the line of the thread that resumed last.
+*/
+LUALIB_API int luaL_memprofile (lua_State *L, size_t rate) {
+  AllocProfiler **box = getmemanchor(L);
+  if (box != NULL && !removememprofiler(L, box))
+    return 0;
+  if (rate > 0) {
+    AllocProfiler *ap;
+    void *ud;
+    lua_Alloc f = lua_getallocf(L, &ud);
+    if (box == NULL) {
+      /* anchor whose finalizer removes the profiler when the state closes */
+      box = (AllocProfiler **)lua_newuserdata(L, sizeof(AllocProfiler *));
+      *box = NULL;
+      luaL_setmetatable(L, MEM_TNAME);
+      lua_rawsetp(L, LUA_REGISTRYINDEX, &memkey);
+    }
+    ap = (AllocProfiler *)f(ud, NULL, 0, sizeof(AllocProfiler));
+    if (ap == NULL) return 0;
+    memset(ap, 0, sizeof(AllocProfiler));
+    ap->f = f;
+    ap->ud = ud;
+    ap->L = G(L)->mainthread;
+    ap->rate = ap->countdown = rate;
+    *box = ap;
+    lua_setallocf(L, memalloc, ap);
+  }
+  return 1;
+}
+
+
+/* orders sites by live heap, then by total allocated, largest first */
+static int livefirst (const void *a, const void *b) {
+  const AllocSite *sa = (const AllocSite *)a;
+  const AllocSite *sb = (const AllocSite *)b;
+  if (sa->live != sb->live)
+    return (sa->live > sb->live) ? -1 : 1;
+  if (sa->total != sb->total)
+    return (sa->total > sb->total) ? -1 : 1;
+  return 0;
+}
+
+
+/*
+** Pushes an array with the statistics of every allocation site seen by
+** the allocation profiler (or nil if it is not running), largest live
+** heap first: tables with fields 'source', 'line', 'live' and 'total'
+** (estimated bytes), 'nlive' and 'ntotal' (sampled blocks).
+*/
+LUALIB_API void luaL_memreport (lua_State *L) {
+  AllocProfiler *ap = getmemprofiler(L);
+  AllocSite *sites;
+  const AllocSite *site;
+  int i, size = 0, n = 0;
+  if (ap == NULL) {
+    lua_pushnil(L);
+    return;
+  }
+  for (i = 0; i < MEM_NSITEBUCKETS; i++)
+    for (site = ap->sites[i]; site != NULL; site = site->next)
+      size++;
+  /* snapshot of the sites, so that building the report does not change
+     the numbers being reported (allocating the snapshot may have added a
+     site, which is left out) */
+  sites = (AllocSite *)lua_newuserdata(L, size * sizeof(AllocSite));
+  for (i = 0; i < MEM_NSITEBUCKETS; i++)
+    for (site = ap->sites[i]; site != NULL && n < size; site = site->next)
+      sites[n++] = *site;
+  qsort(sites, n, sizeof(AllocSite), livefirst);
+  lua_createtable(L, n, 0);
+  for (i = 0; i < n; i++) {
+    site = &sites[i];
+    lua_createtable(L, 0, 6);
+    lua_pushstring(L, site->source);
+    lua_setfield(L, -2, "source");
+    lua_pushinteger(L, site->line);
+    lua_setfield(L, -2, "line");
+    lua_pushnumber(L, cast_num(site->live));
+    lua_setfield(L, -2, "live");
+    lua_pushnumber(L, cast_num(site->total));
+    lua_setfield(L, -2, "total");
+    lua_pushnumber(L, cast_num(site->nlive));
+    lua_setfield(L, -2, "nlive");
+    lua_pushnumber(L, cast_num(site->ntotal));
+    lua_setfield(L, -2, "ntotal");
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_remove(L, -2);  /* remove snapshot */
+}
+
+
+static int mem_gc (lua_State *L) {
+  removememprofiler(L, (AllocProfiler **)luaL_checkudata(L, 1, MEM_TNAME));
+  return 0;
+}
+
+
+static int prof_memstart (lua_State *L) {
+  lua_Number rate = luaL_optnumber(L, 1, MEM_DEFRATE);
+  luaL_argcheck(L, rate >= 1, 1, "rate must be positive");
+  if (!luaL_memprofile(L, (size_t)rate))
+    return luaL_error(L, "cannot start allocation profiler");
+  return 0;
+}
+
+
+static int prof_memstop (lua_State *L) {
+  if (!luaL_memprofile(L, 0))
+    return luaL_error(L, "cannot stop allocation profiler "
+                         "(allocator was replaced)");
+  return 0;
+}
+
+
+static int prof_memreport (lua_State *L) {
+  luaL_memreport(L);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+static const luaL_Reg proflib[] = {
+  {"start", prof_start},
+  {"stop", prof_stop},
+  {"reset", prof_reset},
+  {"folded", prof_folded},
+  {"memstart", prof_memstart},
+  {"memstop", prof_memstop},
+  {"memreport", prof_memreport},
+  {NULL, NULL}
+};
+
+
+LUAMOD_API int luaopen_profile (lua_State *L) {
+  luaL_newmetatable(L, PROF_TNAME);
+  lua_pushcfunction(L, prof_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+  luaL_newmetatable(L, MEM_TNAME);
+  lua_pushcfunction(L, mem_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+  luaL_newlib(L, proflib);
+  return 1;
+}
+
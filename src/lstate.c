@@ -226,10 +226,12 @@ static void close_state (lua_State *L) {
   luaC_freeallobjects(L);  /* collect all objects */
   if (g->version)  /* closing a fully built state? */
     luai_userstateclose(L);
-  luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
-  luaZ_freebuffer(L, &g->buff);
-  freestack(L);
-  lua_assert(gettotalbytes(g) == sizeof(LG));
+  if (!g->bulkfree) {  /* else allocator releases everything below */
+    luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
+    luaZ_freebuffer(L, &g->buff);
+    freestack(L);
+    lua_assert(gettotalbytes(g) == sizeof(LG));
+  }
   (*g->frealloc)(g->ud, fromstate(L), sizeof(LG), 0);  /* free main block */
 }
 
@@ -279,7 +281,10 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   preinit_state(L, g);
   g->frealloc = f;
   g->ud = ud;
+  g->bulkfree = 0;
+  g->optimize = LUAI_OPTIMIZE;
   g->mainthread = L;
+  g->running = L;
   g->seed = makeseed(L);
   g->uvhead.u.l.prev = &g->uvhead;
   g->uvhead.u.l.next = &g->uvhead;
@@ -304,7 +309,13 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gcpause = LUAI_GCPAUSE;
   g->gcmajorinc = LUAI_GCMAJOR;
   g->gcstepmul = LUAI_GCMUL;
+  g->gctiming = 0;
+  g->gccyclefreed = 0;
+  memset(&g->gcstats, 0, sizeof(g->gcstats));
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
+#if defined(LUAI_OPSTATS)
+  luaG_resetopstats(g);
+#endif
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state */
     close_state(L);
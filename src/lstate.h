@@ -10,6 +10,7 @@
 #include "lua.h"
 
 #include "lobject.h"
+#include "lopcodes.h"
 #include "ltm.h"
 #include "lzio.h"
 
@@ -112,6 +113,8 @@ typedef struct CallInfo {
 typedef struct global_State {
   lua_Alloc frealloc;  /* function to reallocate memory */
   void *ud;         /* auxiliary data to `frealloc' */
+  lu_byte bulkfree;  /* true if freeing the main block frees everything */
+  lu_byte optimize;  /* true if the parser runs the bytecode optimizer */
   lu_mem totalbytes;  /* number of bytes currently allocated - GCdebt */
   l_mem GCdebt;  /* bytes allocated not yet compensated by the collector */
   lu_mem GCmemtrav;  /* memory traversed by the GC */
@@ -139,12 +142,28 @@ typedef struct global_State {
   int gcpause;  /* size of pause between successive GCs */
   int gcmajorinc;  /* pause between major collections (only in gen. mode) */
   int gcstepmul;  /* GC `granularity' */
+  lu_byte gctiming;  /* true while a collector step is being timed */
+  lua_Number gcstepstart;  /* start time of the current step */
+  lua_Number gcmark;  /* time already charged to a phase */
+  lu_mem gccyclefreed;  /* bytes freed in the current cycle */
+  lua_GCStats gcstats;  /* collector statistics */
   lua_CFunction panic;  /* to be called in unprotected errors */
   struct lua_State *mainthread;
+  struct lua_State *running;  /* innermost thread being resumed */
   const lua_Number *version;  /* pointer to version number */
   TString *memerrmsg;  /* memory-error message */
   TString *tmname[TM_N];  /* array with tag-method names */
   struct Table *mt[LUA_NUMTAGS];  /* metatables for basic types */
+#if defined(LUAI_OPSTATS)
+  lu_mem opcount[NUM_OPCODES];  /* number of executions of each opcode */
+#if defined(LUAI_OPSTATS_TIME)
+  lu_mem opticks[NUM_OPCODES];  /* time taken by the sampled executions */
+  lu_mem opsamples[NUM_OPCODES];  /* number of sampled executions */
+  lu_mem opstart;  /* start time of the current sample */
+  int opsampled;  /* opcode being sampled (-1 if none) */
+  int opclock;  /* instructions left until the next sample */
+#endif
+#endif
 } global_State;
 
 
@@ -28,13 +28,16 @@
 
 
 /*
-** equality for long strings
+** equality for long strings; hashes, when both are already known,
+** reject most different strings without comparing contents
 */
 int luaS_eqlngstr (TString *a, TString *b) {
   size_t len = a->tsv.len;
   lua_assert(a->tsv.tt == LUA_TLNGSTR && b->tsv.tt == LUA_TLNGSTR);
   return (a == b) ||  /* same instance or... */
     ((len == b->tsv.len) &&  /* equal length and ... */
+     (!a->tsv.extra || !b->tsv.extra ||  /* (unknown hash or... */
+      a->tsv.hash == b->tsv.hash) &&  /* ...equal hashes) and ... */
      (memcmp(getstr(a), getstr(b), len) == 0));  /* equal contents */
 }
 
@@ -58,6 +61,20 @@ unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
 }
 
 
+/*
+** hash of a long string, computed on first use and cached in the
+** header ('extra' marks it valid; until then 'hash' holds the seed)
+*/
+unsigned int luaS_hashlongstr (TString *ts) {
+  lua_assert(ts->tsv.tt == LUA_TLNGSTR);
+  if (ts->tsv.extra == 0) {  /* no hash? */
+    ts->tsv.hash = luaS_hash(getstr(ts), ts->tsv.len, ts->tsv.hash);
+    ts->tsv.extra = 1;  /* now it has its hash */
+  }
+  return ts->tsv.hash;
+}
+
+
 /*
 ** resizes the string table
 */
@@ -100,11 +100,7 @@ static Node *mainposition (const Table *t, const TValue *key) {
       return hashnum(t, nvalue(key));
     case LUA_TLNGSTR: {
       TString *s = rawtsvalue(key);
-      if (s->tsv.extra == 0) {  /* no hash? */
-        s->tsv.hash = luaS_hash(getstr(s), s->tsv.len, s->tsv.hash);
-        s->tsv.extra = 1;  /* now it has its hash */
-      }
-      return hashstr(t, rawtsvalue(key));
+      return hashpow2(t, luaS_hashlongstr(s));
     }
     case LUA_TSHRSTR:
       return hashstr(t, rawtsvalue(key));
@@ -475,12 +471,52 @@ const TValue *luaH_getstr (Table *t, TString *key) {
 }
 
 
+/*
+** search function for short strings that first checks the node slot
+** given by '*hint' (where the key was found last time) and updates it
+** when the key is found somewhere else. Any value is a valid hint.
+*/
+const TValue *luaH_getstrhint (Table *t, TString *key, int *hint) {
+  Node *n;
+  lua_assert(key->tsv.tt == LUA_TSHRSTR);
+  if (*hint < sizenode(t)) {
+    n = gnode(t, *hint);
+    if (ttisshrstring(gkey(n)) && rawtsvalue(gkey(n)) == key)
+      return gval(n);  /* hit */
+  }
+  n = hashstr(t, key);
+  do {  /* check whether `key' is somewhere in the chain */
+    if (ttisshrstring(gkey(n)) && eqshrstr(rawtsvalue(gkey(n)), key)) {
+      *hint = cast_int(n - gnode(t, 0));
+      return gval(n);
+    }
+    else n = gnext(n);
+  } while (n);
+  return luaO_nilobject;
+}
+
+
+/*
+** search function for long strings
+*/
+static const TValue *getlngstr (Table *t, TString *key) {
+  Node *n = hashpow2(t, luaS_hashlongstr(key));
+  do {  /* check whether `key' is somewhere in the chain */
+    if (ttislngstring(gkey(n)) && luaS_eqlngstr(rawtsvalue(gkey(n)), key))
+      return gval(n);  /* that's it */
+    else n = gnext(n);
+  } while (n);
+  return luaO_nilobject;
+}
+
+
 /*
 ** main search function
 */
 const TValue *luaH_get (Table *t, const TValue *key) {
   switch (ttype(key)) {
     case LUA_TSHRSTR: return luaH_getstr(t, rawtsvalue(key));
+    case LUA_TLNGSTR: return getlngstr(t, rawtsvalue(key));
     case LUA_TNIL: return luaO_nilobject;
     case LUA_TNUMBER: {
       int k;
@@ -529,6 +565,55 @@ void luaH_setint (lua_State *L, Table *t, int key, TValue *value) {
 }
 
 
+/*
+** copy src[f..e] into dst[t..t+e-f] (raw accesses; ranges may overlap
+** when 'src' == 'dst'). Ranges inside both array parts are moved in
+** one block.
+*/
+void luaH_move (lua_State *L, Table *src, int f, int e, int t, Table *dst) {
+  int n = e - f + 1;
+  int i;
+  lua_assert(f <= e);
+  if (f >= 1 && t >= 1 && e <= src->sizearray &&
+      t - 1 <= dst->sizearray - n) {
+    memmove(&dst->array[t - 1], &src->array[f - 1], n * sizeof(TValue));
+  }
+  else {
+    int forward = (src != dst || t > e || t <= f);
+    for (i = 0; i < n; i++) {
+      int k = forward ? i : n - 1 - i;
+      TValue v;  /* copy: setting 'dst' may resize 'src' */
+      setobj(L, &v, luaH_getint(src, f + k));
+      if (!ttisnil(&v) || luaH_getint(dst, t + k) != luaO_nilobject)
+        luaH_setint(L, dst, t + k, &v);
+    }
+  }
+  if (src != dst && isblack(obj2gco(dst)))
+    luaC_barrierback_(L, obj2gco(dst));
+}
+
+
+/*
+** remove all entries of 't', keeping the sizes of both parts
+*/
+void luaH_clear (Table *t) {
+  int i;
+  for (i = 0; i < t->sizearray; i++)
+    setnilvalue(&t->array[i]);
+  if (!isdummy(t->node)) {
+    int size = sizenode(t);
+    for (i = 0; i < size; i++) {
+      Node *n = gnode(t, i);
+      gnext(n) = NULL;
+      setnilvalue(gkey(n));
+      setnilvalue(gval(n));
+    }
+    t->lastfree = gnode(t, size);  /* all positions are free */
+  }
+  t->flags = 0;  /* metamethod fields may be gone */
+}
+
+
 static int unbound_search (Table *t, unsigned int j) {
   unsigned int i = j;  /* i is zero or a present index */
   j++;
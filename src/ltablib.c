@@ -7,6 +7,7 @@
 
 #include <limits.h>
 #include <stddef.h>
+#include <string.h>
 
 #define ltablib_c
 #define LUA_LIB
@@ -19,6 +20,8 @@
 
 #define aux_getn(L,n)	(luaL_checktype(L, n, LUA_TTABLE), luaL_len(L, n))
 
+#define MAXSIZE		(~(size_t)0)
+
 
 
 #if defined(LUA_COMPAT_MAXN)
@@ -91,6 +94,62 @@ static void addfield (lua_State *L, luaL_Buffer *b, int i) {
 }
 
 
+/*
+** concatenate a[i..last] in two passes: first add up the lengths of
+** the pieces, then copy them into a buffer of that size. Numbers are
+** converted only in the second pass, so the first one counts them at
+** their largest possible size. Returns 0, with nothing pushed, if the
+** table changed between passes so that the pieces no longer fit (a
+** finalizer may run when allocating the buffer or converting numbers).
+*/
+static int sizedconcat (lua_State *L, const char *sep, size_t lsep,
+                                      int i, int last) {
+  luaL_Buffer b;
+  size_t l, total = 0, pos = 0;
+  char *buff;
+  int k, done = (i > last), top = lua_gettop(L);
+  for (k = i; k <= last; k++) {
+    lua_rawgeti(L, 1, k);
+    if (lua_type(L, -1) == LUA_TNUMBER)
+      l = LUAI_MAXNUMBER2STR;
+    else if (lua_isstring(L, -1))
+      lua_tolstring(L, -1, &l);
+    else
+      luaL_error(L, "invalid value (%s) at index %d in table for "
+                    LUA_QL("concat"), luaL_typename(L, -1), k);
+    lua_pop(L, 1);
+    if (l >= MAXSIZE - total - lsep)
+      luaL_error(L, "resulting string too large");
+    total += l;
+    if (k == last) break;  /* (avoids overflow when 'last' is INT_MAX) */
+    total += lsep;
+  }
+  buff = luaL_buffinitsize(L, &b, total);
+  for (k = i; k <= last; k++) {
+    const char *s;
+    lua_rawgeti(L, 1, k);
+    s = lua_tolstring(L, -1, &l);
+    if (s == NULL || l > total - pos) break;  /* table changed */
+    memcpy(buff + pos, s, l);
+    pos += l;
+    lua_pop(L, 1);
+    if (k == last) {
+      done = 1;
+      break;
+    }
+    if (lsep > total - pos) break;
+    memcpy(buff + pos, sep, lsep);
+    pos += lsep;
+  }
+  if (!done) {
+    lua_settop(L, top);
+    return 0;
+  }
+  luaL_pushresultsize(&b, pos);
+  return 1;
+}
+
+
 static int tconcat (lua_State *L) {
   luaL_Buffer b;
   size_t lsep;
@@ -99,7 +158,9 @@ static int tconcat (lua_State *L) {
   luaL_checktype(L, 1, LUA_TTABLE);
   i = luaL_optint(L, 3, 1);
   last = luaL_opt(L, luaL_checkint, 4, luaL_len(L, 1));
-  luaL_buffinit(L, &b);
+  if (sizedconcat(L, sep, lsep, i, last))
+    return 1;
+  luaL_buffinit(L, &b);  /* table changed: build it incrementally */
   for (; i < last; i++) {
     addfield(L, &b, i);
     luaL_addlstring(&b, sep, lsep);
@@ -156,13 +217,27 @@ static int unpack (lua_State *L) {
 
 /*
 ** {======================================================
-** Quicksort
-** (based on `Algorithms in MODULA-3', Robert Sedgewick;
-**  Addison-Wesley, 1993.)
+** Introsort
+** Quicksort (based on `Algorithms in MODULA-3', Robert Sedgewick;
+** Addison-Wesley, 1993.) that switches to heapsort when partitions get
+** too unbalanced, and to insertion sort for short ranges. Arrays of
+** only numbers or only strings with the default order are copied out
+** and sorted in C, without going through the API for each comparison.
 ** =======================================================
 */
 
 
+#define SORTCUTOFF	12	/* ranges up to this size use insertion sort */
+
+
+/* depth limit for quicksort before switching to heapsort: 2*log2(n) */
+static int sortdepth (int n) {
+  int d = 0;
+  while (n > 1) { n >>= 1; d += 2; }
+  return d;
+}
+
+
 static void set2 (lua_State *L, int i, int j) {
   lua_rawseti(L, 1, i);
   lua_rawseti(L, 1, j);
@@ -183,9 +258,68 @@ static int sort_comp (lua_State *L, int a, int b) {
     return lua_compare(L, a, b, LUA_OPLT);
 }
 
-static void auxsort (lua_State *L, int l, int u) {
-  while (l < u) {  /* for tail recursion */
+static void insertionsort (lua_State *L, int l, int u) {
+  int i, j;
+  for (i = l + 1; i <= u; i++) {
+    lua_rawgeti(L, 1, i);  /* element to insert */
+    for (j = i - 1; j >= l; j--) {
+      lua_rawgeti(L, 1, j);
+      if (!sort_comp(L, -2, -1)) {  /* not a[i] < a[j]? */
+        lua_pop(L, 1);
+        break;
+      }
+      lua_rawseti(L, 1, j + 1);  /* a[j+1] = a[j] */
+    }
+    lua_rawseti(L, 1, j + 1);
+  }
+}
+
+/* sift element 'i' down the heap with 'n' elements starting at a[l] */
+static void siftdown (lua_State *L, int l, int i, int n) {
+  lua_rawgeti(L, 1, l + i);  /* element being sifted */
+  for (;;) {
+    int c = 2*i + 1;  /* first child */
+    if (c >= n) break;
+    lua_rawgeti(L, 1, l + c);
+    if (c + 1 < n) {
+      lua_rawgeti(L, 1, l + c + 1);
+      if (sort_comp(L, -2, -1)) {  /* a[c] < a[c+1]? */
+        lua_remove(L, -2);
+        c++;
+      }
+      else
+        lua_pop(L, 1);
+    }
+    if (!sort_comp(L, -2, -1)) {  /* element not below larger child? */
+      lua_pop(L, 1);
+      break;
+    }
+    lua_rawseti(L, 1, l + i);  /* move child up */
+    i = c;
+  }
+  lua_rawseti(L, 1, l + i);
+}
+
+static void heapsort (lua_State *L, int l, int u) {
+  int n = u - l + 1;
+  int i;
+  for (i = n/2 - 1; i >= 0; i--)
+    siftdown(L, l, i, n);
+  for (i = n - 1; i > 0; i--) {
+    lua_rawgeti(L, 1, l);
+    lua_rawgeti(L, 1, l + i);
+    set2(L, l, l + i);  /* move largest to the end */
+    siftdown(L, l, 0, i);
+  }
+}
+
+static void auxsort (lua_State *L, int l, int u, int depth) {
+  while (u - l >= SORTCUTOFF) {  /* for tail recursion */
     int i, j;
+    if (depth-- == 0) {  /* too many unbalanced partitions? */
+      heapsort(L, l, u);
+      return;
+    }
     /* sort elements a[l], a[(l+u)/2] and a[u] */
     lua_rawgeti(L, 1, l);
     lua_rawgeti(L, 1, u);
@@ -193,7 +327,6 @@ static void auxsort (lua_State *L, int l, int u) {
       set2(L, l, u);  /* swap a[l] - a[u] */
     else
       lua_pop(L, 2);
-    if (u-l == 1) break;  /* only 2 elements */
     i = (l+u)/2;
     lua_rawgeti(L, 1, i);
     lua_rawgeti(L, 1, l);
@@ -207,7 +340,6 @@ static void auxsort (lua_State *L, int l, int u) {
       else
         lua_pop(L, 2);
     }
-    if (u-l == 2) break;  /* only 3 elements */
     lua_rawgeti(L, 1, i);  /* Pivot */
     lua_pushvalue(L, -1);
     lua_rawgeti(L, 1, u-1);
@@ -242,8 +374,155 @@ static void auxsort (lua_State *L, int l, int u) {
     else {
       j=i+1; i=u; u=j-2;
     }
-    auxsort(L, j, i);  /* call recursively the smaller one */
+    auxsort(L, j, i, depth);  /* call recursively the smaller one */
   }  /* repeat the routine for the larger one */
+  insertionsort(L, l, u);
+}
+
+
+/*
+** Sorting of plain arrays: keys are copied into a C array, sorted there
+** with the same algorithm, and written back.
+*/
+
+typedef struct SortKey {
+  lua_Number n;  /* number key */
+  const char *s;  /* string key (kept alive by the snapshot table) */
+  size_t l;  /* length of 's' */
+  int i;  /* original position of a string key */
+} SortKey;
+
+
+/* same order as the '<' operator on strings (see 'l_strcmp' in lvm.c) */
+static int keystrcmp (const SortKey *a, const SortKey *b) {
+  const char *l = a->s;
+  size_t ll = a->l;
+  const char *r = b->s;
+  size_t lr = b->l;
+  for (;;) {
+    int temp = strcoll(l, r);
+    if (temp != 0) return temp;
+    else {  /* strings are equal up to a `\0' */
+      size_t len = strlen(l);  /* index of first `\0' in both strings */
+      if (len == lr)  /* r is finished? */
+        return (len == ll) ? 0 : 1;
+      else if (len == ll)  /* l is finished? */
+        return -1;  /* l is smaller than r (because r is not finished) */
+      /* both strings longer than `len'; go on comparing (after the `\0') */
+      len++;
+      l += len; ll -= len; r += len; lr -= len;
+    }
+  }
+}
+
+#define keyless(a,b,str)	((str) ? keystrcmp(a, b) < 0 : (a)->n < (b)->n)
+
+static void keyswap (SortKey *a, SortKey *b) {
+  SortKey t = *a; *a = *b; *b = t;
+}
+
+static void keysiftdown (SortKey *a, int i, int n, int str) {
+  for (;;) {
+    int c = 2*i + 1;
+    if (c >= n) break;
+    if (c + 1 < n && keyless(&a[c], &a[c + 1], str)) c++;
+    if (!keyless(&a[i], &a[c], str)) break;
+    keyswap(&a[i], &a[c]);
+    i = c;
+  }
+}
+
+static void keysort (SortKey *a, int l, int u, int depth, int str) {
+  int i, j;
+  while (u - l >= SORTCUTOFF) {
+    SortKey p;
+    if (depth-- == 0) {  /* heapsort a[l..u] */
+      int n = u - l + 1;
+      for (i = n/2 - 1; i >= 0; i--)
+        keysiftdown(a + l, i, n, str);
+      for (i = n - 1; i > 0; i--) {
+        keyswap(&a[l], &a[l + i]);
+        keysiftdown(a + l, 0, i, str);
+      }
+      return;
+    }
+    i = (l+u)/2;  /* median of three as pivot, in a[u-1] */
+    if (keyless(&a[u], &a[l], str)) keyswap(&a[u], &a[l]);
+    if (keyless(&a[i], &a[l], str)) keyswap(&a[i], &a[l]);
+    else if (keyless(&a[u], &a[i], str)) keyswap(&a[i], &a[u]);
+    keyswap(&a[i], &a[u - 1]);
+    p = a[u - 1];
+    i = l; j = u - 1;
+    for (;;) {  /* a[l] and a[u] act as sentinels */
+      while (keyless(&a[++i], &p, str)) ;
+      while (keyless(&p, &a[--j], str)) ;
+      if (j < i) break;
+      keyswap(&a[i], &a[j]);
+    }
+    keyswap(&a[u - 1], &a[i]);
+    if (i - l < u - i) {
+      keysort(a, l, i - 1, depth, str);
+      l = i + 1;
+    }
+    else {
+      keysort(a, i + 1, u, depth, str);
+      u = i - 1;
+    }
+  }
+  for (i = l + 1; i <= u; i++) {  /* insertion sort */
+    SortKey t = a[i];
+    for (j = i - 1; j >= l && keyless(&t, &a[j], str); j--)
+      a[j + 1] = a[j];
+    a[j + 1] = t;
+  }
+}
+
+/*
+** sort a[1..n] in C if it holds only numbers (no NaN) or only strings;
+** returns 0, with nothing done, otherwise
+*/
+static int sortplain (lua_State *L, int n) {
+  SortKey *keys;
+  int i, t, last, str;
+  lua_rawgeti(L, 1, 1);
+  lua_rawgeti(L, 1, n);
+  t = lua_type(L, -2);
+  last = lua_type(L, -1);
+  lua_pop(L, 2);
+  /* check both ends before allocating keys for a table that cannot use them */
+  if ((t != LUA_TNUMBER && t != LUA_TSTRING) || last != t) return 0;
+  str = (t == LUA_TSTRING);
+  if ((size_t)n > (~(size_t)0) / sizeof(SortKey)) return 0;
+  keys = (SortKey *)lua_newuserdata(L, n * sizeof(SortKey));
+  if (str) lua_createtable(L, n, 0);  /* snapshot keeps strings alive */
+  for (i = 0; i < n; i++) {
+    SortKey *k = &keys[i];
+    lua_rawgeti(L, 1, i + 1);
+    if (lua_type(L, -1) != (str ? LUA_TSTRING : LUA_TNUMBER))
+      break;  /* mixed types */
+    if (str) {
+      k->s = lua_tolstring(L, -1, &k->l);
+      k->i = i + 1;
+      lua_rawseti(L, 4, i + 1);
+    }
+    else {
+      k->n = lua_tonumber(L, -1);
+      lua_pop(L, 1);
+      if (k->n != k->n) break;  /* NaN has no order */
+    }
+  }
+  if (i < n) {  /* not a plain array? */
+    lua_settop(L, 2);
+    return 0;
+  }
+  keysort(keys, 0, n - 1, sortdepth(n), str);
+  for (i = 0; i < n; i++) {
+    if (str) lua_rawgeti(L, 4, keys[i].i);
+    else lua_pushnumber(L, keys[i].n);
+    lua_rawseti(L, 1, i + 1);
+  }
+  lua_settop(L, 2);
+  return 1;
 }
 
 static int sort (lua_State *L) {
@@ -252,7 +531,67 @@ static int sort (lua_State *L) {
   if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
     luaL_checktype(L, 2, LUA_TFUNCTION);
   lua_settop(L, 2);  /* make sure there is two arguments */
-  auxsort(L, 1, n);
+  if (n > 1 && (!lua_isnil(L, 2) || !sortplain(L, n)))
+    auxsort(L, 1, n, sortdepth(n));
+  return 0;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Bulk operations
+** =======================================================
+*/
+
+static int tcreate (lua_State *L) {
+  int narr = luaL_checkint(L, 1);
+  int nrec = luaL_optint(L, 2, 0);
+  luaL_argcheck(L, narr >= 0, 1, "out of range");
+  luaL_argcheck(L, nrec >= 0, 2, "out of range");
+  lua_createtable(L, narr, nrec);
+  return 1;
+}
+
+
+static int tmove (lua_State *L) {
+  int f = luaL_checkint(L, 2);
+  int e = luaL_checkint(L, 3);
+  int t = luaL_checkint(L, 4);
+  int tt = !lua_isnoneornil(L, 5) ? 5 : 1;  /* destination table */
+  luaL_checktype(L, 1, LUA_TTABLE);
+  luaL_checktype(L, tt, LUA_TTABLE);
+  if (e >= f) {  /* otherwise, nothing to move */
+    luaL_argcheck(L, f > 0 || e < INT_MAX + f, 3,
+                  "too many elements to move");
+    luaL_argcheck(L, t <= INT_MAX - (e - f), 4, "destination wrap around");
+    lua_rawmove(L, 1, f, e, t, tt);
+  }
+  lua_pushvalue(L, tt);  /* return destination table */
+  return 1;
+}
+
+
+static int tclear (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_rawclear(L, 1);
+  return 0;
+}
+
+
+static int tfill (lua_State *L) {
+  int i, last;
+  luaL_checktype(L, 1, LUA_TTABLE);
+  luaL_checkany(L, 2);
+  i = luaL_optint(L, 3, 1);
+  last = luaL_opt(L, luaL_checkint, 4, luaL_len(L, 1));
+  lua_settop(L, 2);
+  for (; i <= last; i++) {
+    lua_pushvalue(L, 2);
+    lua_rawseti(L, 1, i);
+    if (i == last) break;  /* (avoids overflow when 'last' is INT_MAX) */
+  }
   return 0;
 }
 
@@ -260,11 +599,15 @@ static int sort (lua_State *L) {
 
 
 static const luaL_Reg tab_funcs[] = {
+  {"clear", tclear},
   {"concat", tconcat},
+  {"create", tcreate},
+  {"fill", tfill},
 #if defined(LUA_COMPAT_MAXN)
   {"maxn", maxn},
 #endif
   {"insert", tinsert},
+  {"move", tmove},
   {"pack", pack},
   {"unpack", unpack},
   {"remove", tremove},
@@ -38,6 +38,14 @@
 #define LUA_INITVERSION  \
 	LUA_INIT "_" LUA_VERSION_MAJOR "_" LUA_VERSION_MINOR
 
+#if !defined(LUA_ALLOC)
+#define LUA_ALLOC		"LUA_ALLOC"
+#endif
+
+#if !defined(LUA_CACHEDIR)
+#define LUA_CACHEDIR		"LUA_CACHEDIR"
+#endif
+
 
 /*
 ** lua_stdin_is_tty detects whether the standard input is a 'tty' (that
@@ -457,6 +465,8 @@ static int pmain (lua_State *L) {
   lua_gc(L, LUA_GCSTOP, 0);  /* stop collector during initialization */
   luaL_openlibs(L);  /* open libraries */
   lua_gc(L, LUA_GCRESTART, 0);
+  if (!args[has_E] && getenv(LUA_CACHEDIR) != NULL)
+    luaL_setcachedir(L, getenv(LUA_CACHEDIR));  /* cache compiled chunks */
   if (!args[has_E] && handle_luainit(L) != LUA_OK)
     return 0;  /* error running LUA_INIT */
   /* execute arguments -e and -l */
@@ -477,9 +487,24 @@ static int pmain (lua_State *L) {
 }
 
 
+/*
+** create the state with the allocator named by LUA_ALLOC, if any
+*/
+static lua_State *newstate (void) {
+  const char *alloc = getenv(LUA_ALLOC);
+  if (alloc != NULL && strcmp(alloc, "defer") == 0)
+    return luaL_newdeferstate();
+  else if (alloc != NULL && strcmp(alloc, "pool") == 0)
+    return luaL_newpoolstate();
+  else if (alloc != NULL && strcmp(alloc, "arena") == 0)
+    return luaL_newarenastate();
+  return luaL_newstate();
+}
+
+
 int main (int argc, char **argv) {
   int status, result;
-  lua_State *L = luaL_newstate();  /* create state */
+  lua_State *L = newstate();  /* create state */
   if (L == NULL) {
     l_message(argv[0], "cannot create state: not enough memory");
     return EXIT_FAILURE;
@@ -241,6 +241,9 @@ LUA_API void  (lua_setfield) (lua_State *L, int idx, const char *k);
 LUA_API void  (lua_rawset) (lua_State *L, int idx);
 LUA_API void  (lua_rawseti) (lua_State *L, int idx, int n);
 LUA_API void  (lua_rawsetp) (lua_State *L, int idx, const void *p);
+LUA_API void  (lua_rawmove) (lua_State *L, int idx1, int f, int e, int t,
+                                           int idx2);
+LUA_API void  (lua_rawclear) (lua_State *L, int idx);
 LUA_API int   (lua_setmetatable) (lua_State *L, int objindex);
 LUA_API void  (lua_setuservalue) (lua_State *L, int idx);
 
@@ -290,10 +293,35 @@ LUA_API int  (lua_status) (lua_State *L);
 #define LUA_GCISRUNNING		9
 #define LUA_GCGEN		10
 #define LUA_GCINC		11
+#define LUA_GCSTEPUS		12	/* 1 if a cycle completed (see lgc.c) */
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
 
+/*
+** garbage-collection statistics
+*/
+#define LUA_GCPPROPAGATE	0
+#define LUA_GCPATOMIC		1
+#define LUA_GCPSWEEPSTRING	2
+#define LUA_GCPSWEEPUDATA	3
+#define LUA_GCPSWEEP		4
+
+#define LUA_GCPHASES		5
+
+typedef struct lua_GCStats {
+  lua_Number time[LUA_GCPHASES];  /* microseconds spent in each phase */
+  lua_Number work[LUA_GCPHASES];  /* work units done in each phase */
+  lua_Number cycles;  /* number of completed cycles */
+  lua_Number freed;  /* bytes freed by sweeps */
+  lua_Number lastfreed;  /* bytes freed by the last completed cycle */
+  lua_Number finalizers;  /* number of finalizers called */
+  lua_Number maxpause;  /* longest step, finalizers excluded (microseconds) */
+} lua_GCStats;
+
+LUA_API void (lua_gcstats) (lua_State *L, lua_GCStats *stats, int reset);
+
+
 /*
 ** miscellaneous functions
 */
@@ -307,6 +335,7 @@ LUA_API void  (lua_len)    (lua_State *L, int idx);
 
 LUA_API lua_Alloc (lua_getallocf) (lua_State *L, void **ud);
 LUA_API void      (lua_setallocf) (lua_State *L, lua_Alloc f, void *ud);
+LUA_API void      (lua_setbulkfree) (lua_State *L, int bulk);
 
 
 
@@ -395,6 +424,11 @@ LUA_API lua_Hook (lua_gethook) (lua_State *L);
 LUA_API int (lua_gethookmask) (lua_State *L);
 LUA_API int (lua_gethookcount) (lua_State *L);
 
+LUA_API const char *(lua_opstats) (lua_State *L, int op, lua_Number *count,
+                                                        lua_Number *ticks);
+LUA_API void (lua_resetopstats) (lua_State *L);
+LUA_API int (lua_optimize) (lua_State *L, int on);
+
 
 struct lua_Debug {
   int event;
@@ -71,6 +71,7 @@
 #define LUA_USE_POPEN
 #define LUA_USE_ULONGJMP
 #define LUA_USE_GMTIME_R
+#define LUA_USE_PTHREAD		/* may need an extra library: -lpthread */
 #endif
 
 
@@ -452,6 +453,53 @@
 
 
 
+/*
+@@ LUA_USE_JUMPTABLE makes the interpreter dispatch opcodes through a
+** table of label addresses (threaded code) instead of a 'switch'. It
+** needs the "labels as values" extension of GCC and Clang.
+** CHANGE it to 0 to always use the portable 'switch'.
+*/
+#if !defined(LUA_USE_JUMPTABLE)
+#if defined(__GNUC__) && !defined(LUA_ANSI)
+#define LUA_USE_JUMPTABLE	1
+#else
+#define LUA_USE_JUMPTABLE	0
+#endif
+#endif
+
+
+
+/*
+@@ LUAI_OPSTATS makes the interpreter count how many times each opcode
+** is executed (see 'lua_opstats' and 'debug.opstats').
+@@ LUAI_OPSTATS_TIME also samples the time taken by one instruction in
+** every LUAI_OPSTATS_RATE, in CPU cycles (x86) or nanoseconds.
+** Both are off by default; when off they cost nothing.
+*/
+/* #define LUAI_OPSTATS */
+/* #define LUAI_OPSTATS_TIME */
+
+#if defined(LUAI_OPSTATS_TIME) && !defined(LUAI_OPSTATS)
+#define LUAI_OPSTATS
+#endif
+
+#if !defined(LUAI_OPSTATS_RATE)
+#define LUAI_OPSTATS_RATE	64
+#endif
+
+
+/*
+@@ LUAI_OPTIMIZE is the initial setting of the bytecode optimizer of
+** new states (see 'lua_optimize' and 'debug.optimize'). The optimizer
+** threads jumps and removes dead instructions from each function it
+** compiles; it is off by default.
+*/
+#if !defined(LUAI_OPTIMIZE)
+#define LUAI_OPTIMIZE	0
+#endif
+
+
+
 /*
 @@ LUA_INTEGER is the integral type used by lua_pushinteger/lua_tointeger.
 ** CHANGE that if ptrdiff_t is not adequate on your machine. (On most
@@ -44,6 +44,13 @@ LUAMOD_API int (luaopen_package) (lua_State *L);
 #define LUA_ERISLIBNAME	"eris"
 LUAMOD_API int (luaopen_eris) (lua_State *L);
 
+#define LUA_PROFLIBNAME	"profile"
+LUAMOD_API int (luaopen_profile) (lua_State *L);
+
+/* allocation profiler of the profile library */
+LUALIB_API int (luaL_memprofile) (lua_State *L, size_t rate);
+LUALIB_API void (luaL_memreport) (lua_State *L);
+
 
 /* open all previous libraries */
 LUALIB_API void (luaL_openlibs) (lua_State *L);
@@ -18,6 +18,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "lmem.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -417,6 +418,24 @@ static void pushclosure (lua_State *L, Proto *p, UpVal **encup, StkId base,
 }
 
 
+/*
+** inline caches: accesses to tables with a constant short string as key
+** first try the node where the same instruction found its key the last
+** time. 'luaH_getstrhint' validates the hint, so a resized (or simply
+** another) table only costs a regular lookup. This returns the hint of
+** the instruction at 'pc', creating the caches of 'p' on first use.
+*/
+static int *icslot (lua_State *L, Proto *p, const Instruction *pc) {
+  if (p->icache == NULL) {
+    int *ic = luaM_newvector(L, p->sizecode, int);
+    int j;
+    for (j = 0; j < p->sizecode; j++) ic[j] = 0;
+    p->icache = ic;
+  }
+  return &p->icache[pc - p->code];
+}
+
+
 /*
 ** finish execution of an opcode interrupted by an yield
 */
@@ -527,15 +546,113 @@ void luaV_finishOp (lua_State *L) {
         else { Protect(luaV_arith(L, ra, rb, rc, tm)); } }
 
 
+/* non-nil value of constant key 'RK(x)' in table 't' through the cache */
+#define icget(t,x,v) \
+  (ttistable(t) && ISK(x) && ttisshrstring(k+INDEXK(x)) && \
+   (v = luaH_getstrhint(hvalue(t), rawtsvalue(k+INDEXK(x)), \
+                        icslot(L, cl->p, ci->u.l.savedpc - 1)), \
+    !ttisnil(v)))
+
+/* store 'val' over an existing (non-nil) entry 'v' of table 't' */
+#define icset(t,v,val) { \
+        Table *h = hvalue(t); \
+        setobj2t(L, cast(TValue *, v), val); \
+        invalidateTMcache(h); \
+        luaC_barrierback(L, obj2gco(h), val); }
+
+
+#if defined(LUAI_OPSTATS_TIME)
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define optime()	cast(lu_mem, __builtin_ia32_rdtsc())
+#elif defined(LUA_USE_POSIX)
+#include <time.h>
+static lu_mem optime (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return cast(lu_mem, ts.tv_sec) * 1000000000u + cast(lu_mem, ts.tv_nsec);
+}
+#else
+#define optime()	cast(lu_mem, clock())
+#endif
+
+/*
+** ends the current time sample (an instruction ends when the next one
+** is fetched) and starts a new one for 'op' when it is time to
+*/
+static void opsample (global_State *g, OpCode op) {
+  if (g->opsampled >= 0) {
+    g->opticks[g->opsampled] += optime() - g->opstart;
+    g->opsamples[g->opsampled]++;
+    g->opsampled = -1;
+  }
+  else {  /* clock expired */
+    g->opclock = LUAI_OPSTATS_RATE;
+    g->opsampled = op;
+    g->opstart = optime();
+  }
+}
+
+#define opstats(L,i)	{ global_State *g_ = G(L); \
+  g_->opcount[GET_OPCODE(i)]++; \
+  if (g_->opsampled >= 0 || --g_->opclock == 0) \
+    opsample(g_, GET_OPCODE(i)); }
+
+#elif defined(LUAI_OPSTATS)
+#define opstats(L,i)	(G(L)->opcount[GET_OPCODE(i)]++)
+#else
+#define opstats(L,i)	((void)0)
+#endif
+
+
+/* fetch the next instruction into 'i' and its register A into 'ra' */
+#define vmfetch()	{ \
+  i = *(ci->u.l.savedpc++); \
+  opstats(L, i); \
+  if ((L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) && \
+      (--L->hookcount == 0 || L->hookmask & LUA_MASKLINE)) { \
+    Protect(traceexec(L)); \
+  } \
+  /* WARNING: several calls may realloc the stack and invalidate `ra' */ \
+  ra = RA(i); \
+  lua_assert(base == ci->u.l.base); \
+  lua_assert(base <= L->top && L->top < L->stack + L->stacksize); }
+
+#if LUA_USE_JUMPTABLE
+/*
+** threaded code: every opcode ends with its own fetch and indirect jump
+** (through 'disptab'), instead of going back to a single 'switch'
+*/
+#define vmdispatch(o)	goto *disptab[o];
+#define vmcase(l,b)	L_##l: {b}  vmfetch(); vmdispatch(GET_OPCODE(i));
+#define vmcasenb(l,b)	L_##l: {b}		/* nb = no break */
+#else
 #define vmdispatch(o)	switch(o)
 #define vmcase(l,b)	case l: {b}  break;
 #define vmcasenb(l,b)	case l: {b}		/* nb = no break */
+#endif
 
 void luaV_execute (lua_State *L) {
   CallInfo *ci = L->ci;
   LClosure *cl;
   TValue *k;
   StkId base;
+#if LUA_USE_JUMPTABLE
+  /* label of each opcode, in the order of 'OpCode' (see lopcodes.h) */
+  static const void *const disptab[] = {
+    &&L_OP_MOVE, &&L_OP_LOADK, &&L_OP_LOADKX, &&L_OP_LOADBOOL,
+    &&L_OP_LOADNIL, &&L_OP_GETUPVAL, &&L_OP_GETTABUP, &&L_OP_GETTABLE,
+    &&L_OP_SETTABUP, &&L_OP_SETUPVAL, &&L_OP_SETTABLE, &&L_OP_NEWTABLE,
+    &&L_OP_SELF, &&L_OP_ADD, &&L_OP_SUB, &&L_OP_MUL, &&L_OP_DIV,
+    &&L_OP_MOD, &&L_OP_POW, &&L_OP_UNM, &&L_OP_NOT, &&L_OP_LEN,
+    &&L_OP_CONCAT, &&L_OP_JMP, &&L_OP_EQ, &&L_OP_LT, &&L_OP_LE,
+    &&L_OP_TEST, &&L_OP_TESTSET, &&L_OP_CALL, &&L_OP_TAILCALL,
+    &&L_OP_RETURN, &&L_OP_FORLOOP, &&L_OP_FORPREP, &&L_OP_TFORCALL,
+    &&L_OP_TFORLOOP, &&L_OP_SETLIST, &&L_OP_CLOSURE, &&L_OP_VARARG,
+    &&L_OP_EXTRAARG
+  };
+  lua_assert(sizeof(disptab)/sizeof(disptab[0]) == NUM_OPCODES);
+#endif
  newframe:  /* reentry point when frame changes (call/return) */
   lua_assert(ci == L->ci);
   cl = clLvalue(ci->func);
@@ -543,16 +660,9 @@ void luaV_execute (lua_State *L) {
   base = ci->u.l.base;
   /* main loop of interpreter */
   for (;;) {
-    Instruction i = *(ci->u.l.savedpc++);
+    Instruction i;
     StkId ra;
-    if ((L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) &&
-        (--L->hookcount == 0 || L->hookmask & LUA_MASKLINE)) {
-      Protect(traceexec(L));
-    }
-    /* WARNING: several calls may realloc the stack and invalidate `ra' */
-    ra = RA(i);
-    lua_assert(base == ci->u.l.base);
-    lua_assert(base <= L->top && L->top < L->stack + L->stacksize);
+    vmfetch();
     vmdispatch (GET_OPCODE(i)) {
       vmcase(OP_MOVE,
         setobjs2s(L, ra, RB(i));
@@ -583,14 +693,24 @@ void luaV_execute (lua_State *L) {
       )
       vmcase(OP_GETTABUP,
         int b = GETARG_B(i);
-        Protect(luaV_gettable(L, cl->upvals[b]->v, RKC(i), ra));
+        TValue *t = cl->upvals[b]->v;
+        const TValue *v;
+        if (icget(t, GETARG_C(i), v)) { setobj2s(L, ra, v); }
+        else Protect(luaV_gettable(L, t, RKC(i), ra));
       )
       vmcase(OP_GETTABLE,
-        Protect(luaV_gettable(L, RB(i), RKC(i), ra));
+        TValue *rb = RB(i);
+        const TValue *v;
+        if (icget(rb, GETARG_C(i), v)) { setobj2s(L, ra, v); }
+        else Protect(luaV_gettable(L, rb, RKC(i), ra));
       )
       vmcase(OP_SETTABUP,
         int a = GETARG_A(i);
-        Protect(luaV_settable(L, cl->upvals[a]->v, RKB(i), RKC(i)));
+        TValue *t = cl->upvals[a]->v;
+        TValue *rc = RKC(i);
+        const TValue *v;
+        if (icget(t, GETARG_B(i), v)) icset(t, v, rc)
+        else Protect(luaV_settable(L, t, RKB(i), rc));
       )
       vmcase(OP_SETUPVAL,
         UpVal *uv = cl->upvals[GETARG_B(i)];
@@ -598,7 +718,10 @@ void luaV_execute (lua_State *L) {
         luaC_barrier(L, uv, ra);
       )
       vmcase(OP_SETTABLE,
-        Protect(luaV_settable(L, ra, RKB(i), RKC(i)));
+        TValue *rc = RKC(i);
+        const TValue *v;
+        if (icget(ra, GETARG_B(i), v)) icset(ra, v, rc)
+        else Protect(luaV_settable(L, ra, RKB(i), rc));
       )
       vmcase(OP_NEWTABLE,
         int b = GETARG_B(i);
@@ -611,8 +734,10 @@ void luaV_execute (lua_State *L) {
       )
       vmcase(OP_SELF,
         StkId rb = RB(i);
+        const TValue *v;
         setobjs2s(L, ra+1, rb);
-        Protect(luaV_gettable(L, rb, RKC(i), ra));
+        if (icget(rb, GETARG_C(i), v)) { setobj2s(L, ra, v); }
+        else Protect(luaV_gettable(L, rb, RKC(i), ra));
       )
       vmcase(OP_ADD,
         arith_op(luai_numadd, TM_ADD);
@@ -797,6 +922,7 @@ void luaV_execute (lua_State *L) {
         Protect(luaD_call(L, cb, GETARG_C(i), 1));
         L->top = ci->top;
         i = *(ci->u.l.savedpc++);  /* go to next instruction */
+        opstats(L, i);
         ra = RA(i);
         lua_assert(GET_OPCODE(i) == OP_TFORLOOP);
         goto l_tforloop;
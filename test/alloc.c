@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+
+/* The allocator the state was created with. */
+static lua_Alloc origf;
+static void *origud;
+
+/* Finalizers expected to run while closing the state, and those run. */
+static int expected, closed;
+
+/* sameallocator() -> whether the state uses its original allocator */
+static int LUAF_sameallocator(lua_State *L)
+{
+	void *ud;
+	lua_Alloc f = lua_getallocf(L, &ud);
+	lua_pushboolean(L, f == origf && ud == origud);
+	return 1;
+}
+
+/* poolstats() -> table with the statistics of a pool state, or nil */
+static int LUAF_poolstats(lua_State *L)
+{
+	luaL_PoolStats stats;
+	if (!luaL_poolstats(L, &stats)) {
+		lua_pushnil(L);
+		return 1;
+	}
+	lua_createtable(L, 0, 4);
+	lua_pushnumber(L, (lua_Number)stats.slabbytes);
+	lua_setfield(L, -2, "slabbytes");
+	lua_pushnumber(L, (lua_Number)stats.poolbytes);
+	lua_setfield(L, -2, "poolbytes");
+	lua_pushnumber(L, (lua_Number)stats.poolallocs);
+	lua_setfield(L, -2, "poolallocs");
+	lua_pushnumber(L, (lua_Number)stats.largeallocs);
+	lua_setfield(L, -2, "largeallocs");
+	return 1;
+}
+
+/* expectclose(n): n finalizers calling closed() must run in lua_close */
+static int LUAF_expectclose(lua_State *L)
+{
+	expected = luaL_checkint(L, 1);
+	closed = 0;
+	return 0;
+}
+
+static int LUAF_closed(lua_State *L)
+{
+	(void)L;
+	++closed;
+	return 0;
+}
+
+static int LUAF_onerror(lua_State *L)
+{
+	luaL_traceback(L, L, lua_tostring(L, 1), 1);
+	printf("%s\n", lua_tostring(L, -1));
+	return 1;
+}
+
+int main(int argc, char** argv)
+{
+	lua_State* L;
+	int status;
+	const char *alloc = getenv("LUA_ALLOC");
+	if (argc < 2) {
+		printf("Usage: [LUA_ALLOC=defer|pool|arena] alloc <script>\n");
+		return 1;
+	}
+	if (alloc != NULL && strcmp(alloc, "defer") == 0)
+		L = luaL_newdeferstate();
+	else if (alloc != NULL && strcmp(alloc, "pool") == 0)
+		L = luaL_newpoolstate();
+	else if (alloc != NULL && strcmp(alloc, "arena") == 0)
+		L = luaL_newarenastate();
+	else
+		L = luaL_newstate();
+	if (L == NULL) {
+		printf("cannot create state\n");
+		return 1;
+	}
+	origf = lua_getallocf(L, &origud);
+
+	luaL_openlibs(L);
+	lua_settop(L, 0);
+
+	lua_register(L, "sameallocator", LUAF_sameallocator);
+	lua_register(L, "poolstats", LUAF_poolstats);
+	lua_register(L, "expectclose", LUAF_expectclose);
+	lua_register(L, "closed", LUAF_closed);
+
+	lua_pushcfunction(L, LUAF_onerror);
+	status = luaL_loadfile(L, argv[1]);
+	if (status == LUA_OK) {
+		status = lua_pcall(L, 0, 0, 1);
+	}
+	else {
+		printf("%s\n", lua_tostring(L, -1));
+	}
+
+	lua_close(L);
+	if (closed != expected) {
+		printf("%d of %d finalizers ran when closing the state\n",
+		       closed, expected);
+		return 1;
+	}
+
+	return status == LUA_OK ? 0 : 1;
+}
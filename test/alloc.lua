@@ -0,0 +1,78 @@
+-- Exercises the allocator of the state under an allocation and finalizer
+-- heavy load. Run by `make test` through the test driver once per
+-- allocator, as
+--   [LUA_ALLOC=defer|pool|arena] test/alloc test/alloc.lua
+
+local mode = os.getenv("LUA_ALLOC") or "default"
+local pooled = (mode == "pool" or mode == "arena")
+
+local stats = poolstats()
+assert((stats ~= nil) == pooled, "poolstats on a " .. mode .. " state")
+
+-- blocks of every size class, moving between classes and to the system
+local function churn(rounds)
+  local keep = {}
+  for r = 1, rounds do
+    local t = {}
+    for i = 1, 300 do t[i] = i end  -- array part grows through all classes
+    for i = 1, 40 do t["k" .. i .. "_" .. r] = i end  -- and the hash part
+    for i = 300, 1, -1 do t[i] = nil end
+    t.x = 1  -- rehash shrinks it again
+    keep[r % 64] = {t, string.rep("s", r % 600), function() return r end}
+    local co = coroutine.wrap(function(...)
+      local deep = {}
+      for i = 1, 50 do deep[i] = {...} end
+      coroutine.yield(#deep)
+      return string.rep("x", 1000)
+    end)
+    co(r, r)
+    assert(#co() == 1000)
+  end
+  return keep
+end
+
+local keep = churn(2000)
+local big = {}
+for i = 1, 20 do big[i] = string.rep(string.char(64 + i), 100000 * i) end
+collectgarbage()
+
+if pooled then
+  local s = poolstats()
+  assert(s.poolallocs > stats.poolallocs and s.largeallocs > stats.largeallocs)
+  assert(s.poolbytes > 0 and s.poolbytes <= s.slabbytes)
+  assert(s.slabbytes % (64 * 1024) == 0)
+  keep, big = nil, nil
+  collectgarbage()
+  local after = poolstats()
+  assert(after.poolbytes < s.poolbytes, "freed blocks not returned to pools")
+  assert(after.slabbytes == s.slabbytes)  -- slabs are kept until closing
+  churn(500)  -- reuses the free lists
+  collectgarbage()
+  assert(poolstats().slabbytes <= s.slabbytes + 2 * 64 * 1024)
+end
+
+-- finalizers, including resurrection and finalizers allocating
+local finalized, resurrected = 0, {}
+local mt = {__gc = function(o)
+  finalized = finalized + 1
+  if o.n % 100 == 0 then resurrected[#resurrected + 1] = o end
+  local _ = {string.rep("g", o.n % 300)}
+end}
+for i = 1, 20000 do setmetatable({n = i}, mt) end
+collectgarbage()
+collectgarbage()
+assert(finalized == 20000, "finalizers lost: " .. finalized)
+assert(#resurrected == 200 and resurrected[1].n % 100 == 0)
+resurrected = nil
+collectgarbage()
+
+-- finalizers of objects alive at the end must run when closing the state
+-- (an arena releases the objects in bulk but still calls them)
+expectclose(1000)
+ALIVE = {}
+local closemt = {__gc = function(o) closed() end}
+for i = 1, 1000 do ALIVE[i] = setmetatable({string.rep("a", i)}, closemt) end
+ALIVE.cycle = ALIVE
+ALIVE.big = string.rep("b", 1000000)
+
+print("Allocator (" .. mode .. "): OK")
@@ -0,0 +1,116 @@
+-- Interpreter micro benchmarks. Run with `make bench`, or directly as
+--   src/lua test/bench.lua [repeats]
+-- Each benchmark is run several times and the best time is reported, so
+-- builds can be compared (e.g. with and without LUA_USE_JUMPTABLE).
+
+local repeats = tonumber(arg and arg[1]) or 5
+
+local benchmarks = {}
+
+-------------------------------------------------------------------------------
+-- Dispatch heavy loops: mostly cheap opcodes, so the cost of getting from
+-- one instruction to the next dominates.
+
+benchmarks[#benchmarks + 1] = {"Arithmetic loop", function()
+  local a, b = 0, 1
+  for i = 1, 5000000 do
+    a = a + i * 2 - b
+    b = (b + 1) % 7
+  end
+  return a
+end}
+
+benchmarks[#benchmarks + 1] = {"Fibonacci calls", function()
+  local function fib(n)
+    if n < 2 then return n end
+    return fib(n - 1) + fib(n - 2)
+  end
+  return fib(30)
+end}
+
+benchmarks[#benchmarks + 1] = {"Table fields", function()
+  local t = {x = 0, y = 0, z = 0}
+  for i = 1, 2000000 do
+    t.x = t.x + 1
+    t.y = t.x + t.z
+    t.z = t.y - i
+  end
+  return t.x
+end}
+
+benchmarks[#benchmarks + 1] = {"Global access", function()
+  counter = 0
+  for i = 1, 2000000 do
+    counter = counter + math.abs(-i) % 3
+  end
+  return counter
+end}
+
+benchmarks[#benchmarks + 1] = {"Method calls", function()
+  local Point = {}
+  Point.__index = Point
+  function Point:move(dx) self.x = self.x + dx return self end
+  local p = setmetatable({x = 0}, Point)
+  for i = 1, 2000000 do
+    p:move(1)
+  end
+  return p.x
+end}
+
+benchmarks[#benchmarks + 1] = {"Array fill", function()
+  local sum = 0
+  for _ = 1, 20 do
+    local t = {}
+    for i = 1, 100000 do t[i] = i end
+    for i = 1, #t do sum = sum + t[i] end
+  end
+  return sum
+end}
+
+benchmarks[#benchmarks + 1] = {"String building", function()
+  local parts = {}
+  for i = 1, 200000 do
+    parts[#parts + 1] = "item" .. i
+  end
+  return #table.concat(parts, ",")
+end}
+
+-------------------------------------------------------------------------------
+-- Allocation heavy: many small, short lived objects, so the allocator
+-- shows up (compare `LUA_ALLOC=pool src/lua test/bench.lua`).
+
+benchmarks[#benchmarks + 1] = {"Small tables", function()
+  local keep
+  for i = 1, 500000 do
+    keep = {i, x = i}
+  end
+  return keep.x
+end}
+
+benchmarks[#benchmarks + 1] = {"Closures", function()
+  local sum = 0
+  for i = 1, 500000 do
+    local f = function() return i end
+    sum = sum + f()
+  end
+  return sum
+end}
+
+-------------------------------------------------------------------------------
+
+local total = 0
+print(string.format("%-23s %10s", "Benchmark",
+                    "best (s), allocator: " .. (os.getenv("LUA_ALLOC") or "default")))
+for _, bench in ipairs(benchmarks) do
+  local name, fn = bench[1], bench[2]
+  local best = math.huge
+  for _ = 1, repeats do
+    collectgarbage()
+    local start = os.clock()
+    fn()
+    best = math.min(best, os.clock() - start)
+  end
+  total = total + best
+  print(string.format("%-23s %10.3f", name, best))
+end
+print(string.format("%-23s %10.3f", "Total", total))
@@ -0,0 +1,95 @@
+-- Tests for the bytecode cache of luaL_loadfilex, through the LUA_CACHEDIR
+-- variable of the stand-alone interpreter. Run by `make test`, or as
+--   src/lua test/cache.lua
+
+local lua = arg[-1]
+if package.config:sub(1, 1) ~= "/" or not io.popen then
+  print("Bytecode cache: not supported on this platform, skipped")
+  return
+end
+
+local base = os.tmpname()
+os.remove(base)
+assert(os.execute("mkdir '" .. base .. "' '" .. base .. "/cache'"))
+local cache, src = base .. "/cache", base .. "/chunk.lua"
+
+local function write(name, data)
+  local f = assert(io.open(name, "wb"))
+  f:write(data)
+  f:close()
+end
+
+local function read(name)
+  local f = assert(io.open(name, "rb"))
+  local data = f:read("*a")
+  f:close()
+  return data
+end
+
+local function entries()  -- names of the entries in the cache
+  local ls, list = io.popen("ls '" .. cache .. "'"), {}
+  for name in ls:lines() do list[#list + 1] = name end
+  ls:close()
+  return list
+end
+
+-- runs the interpreter with 'dir' as cache; returns what it printed
+local function run(dir, args)
+  local p = io.popen(string.format("LUA_CACHEDIR='%s' '%s' %s 2>&1",
+                                   dir, lua, args or "'" .. src .. "'"))
+  local out = p:read("*a")
+  p:close()
+  return out
+end
+
+-- replaces the chunk in the (only) entry, keeping its header: a load that
+-- prints "cached" then comes from the cache
+local function tamper()
+  local list = entries()
+  assert(#list == 1, "expected one entry, found " .. #list)
+  local name = cache .. "/" .. list[1]
+  local data = read(name)
+  local at = data:find("\27Lua\x52", 2, true)  -- the dumped function
+  assert(at, "no binary chunk in the entry")
+  write(name, data:sub(1, at - 1) .. string.dump(load("print('cached')")))
+end
+
+-- a miss creates an entry, which the next load uses
+write(src, "print('source', 1)\n")
+assert(#entries() == 0)
+assert(run(cache) == "source\t1\n")
+assert(#entries() == 1, "no entry written")
+assert(run(cache) == "source\t1\n")
+tamper()
+assert(run(cache) == "cached\n", "entry not used")
+
+-- a stale entry (same size and, likely, mtime: only the hash differs) is
+-- ignored and replaced
+write(src, "print('source', 2)\n")
+assert(run(cache) == "source\t2\n", "stale entry used")
+assert(#entries() == 1)
+tamper()
+assert(run(cache) == "cached\n", "entry not replaced")
+
+-- loads that do not accept both text and binary chunks bypass the cache
+local function loadmode(mode)
+  return string.format("-e \"local f, e = loadfile('%s', '%s') " ..
+                       "if f then f() else print(e) end\"", src, mode)
+end
+assert(run(cache, loadmode("t")) == "source\t2\n", "mode 't' used the cache")
+assert(run(cache, loadmode("b")):find("attempt to load a text chunk"),
+       "mode 'b' used the cache")
+assert(run(cache, loadmode("bt")) == "cached\n")
+
+-- a missing or unusable cache directory falls back to the source
+assert(run(base .. "/missing") == "source\t2\n")
+assert(io.open(base .. "/missing") == nil)
+assert(run(src) == "source\t2\n")  -- a file, not a directory
+assert(read(src) == "print('source', 2)\n")
+
+for _, name in ipairs(entries()) do os.remove(cache .. "/" .. name) end
+os.remove(cache)
+os.remove(src)
+os.remove(base)
+
+print("Bytecode cache: OK")
@@ -0,0 +1,96 @@
+-- Tests for the collector statistics (collectgarbage "stats") and for
+-- timed steps (collectgarbage "stepus"). Run by `make test`, or directly as
+--   src/lua test/gc.lua
+
+local phases = {"propagate", "atomic", "sweepstring", "sweepudata", "sweep"}
+
+local function total(s)
+  local t = 0
+  for _, p in ipairs(phases) do t = t + s.time[p] end
+  return t
+end
+
+local function garbage(n)
+  for i = 1, n do local _ = {i} end
+end
+
+local function busy(seconds)  -- spends 'seconds' of CPU time in Lua
+  local t = os.clock()
+  while os.clock() - t < seconds do end
+end
+
+-- the layout of the statistics, and resetting them
+do
+  collectgarbage()
+  collectgarbage("stats", 1)
+  local n = 0
+  setmetatable({}, {__gc = function() n = n + 1 end})
+  garbage(10000)
+  collectgarbage()
+  collectgarbage()
+  local s = collectgarbage("stats")
+  for _, p in ipairs(phases) do
+    assert(type(s.time[p]) == "number" and s.time[p] >= 0, p)
+    assert(type(s.work[p]) == "number" and s.work[p] >= 0, p)
+  end
+  assert(s.cycles >= 2 and s.work.propagate > 0 and s.work.sweep > 0)
+  assert(s.freed > 0 and s.lastfreed >= 0 and s.lastfreed <= s.freed)
+  assert(s.finalizers == 1 and n == 1)
+  assert(s.maxpause > 0 and s.maxpause <= total(s))
+  s = collectgarbage("stats", 1)  -- returns the old values, then resets
+  assert(s.cycles >= 2)
+  s = collectgarbage("stats")
+  assert(s.cycles == 0 and s.freed == 0 and s.finalizers == 0)
+  assert(s.maxpause == 0 and total(s) == 0)
+end
+
+-- finalizers run outside the timed step: an error in one leaves no step
+-- open, so later steps are still timed and mutator time is not charged
+for _, mode in ipairs{"incremental", "generational"} do
+  collectgarbage(mode)
+  collectgarbage()
+  setmetatable({}, {__gc = function() error("boom") end})
+  local ok, msg
+  for i = 1, 1000 do
+    ok, msg = pcall(collectgarbage, "step")
+    if not ok then break end
+  end
+  assert(not ok and msg:find("error in __gc metamethod"), msg)
+  collectgarbage("stop")
+  collectgarbage("stats", 1)
+  busy(0.1)
+  garbage(10000)
+  collectgarbage("step")
+  collectgarbage("restart")
+  local s = collectgarbage("stats")
+  assert(total(s) < 50000, mode .. ": mutator time charged to the collector")
+  assert(s.maxpause > 0, mode .. ": steps no longer timed")
+  collectgarbage("incremental")
+end
+
+-- "stepus" returns true when its steps complete a cycle
+do
+  collectgarbage()
+  local big = {}
+  for i = 1, 200000 do big[i] = {} end
+  collectgarbage("stop")
+  collectgarbage("step", 0)  -- begin a cycle
+  local cycles = collectgarbage("stats").cycles
+  assert(collectgarbage("stepus", 1) == false, "cycle done in 1us")
+  assert(collectgarbage("stats").cycles == cycles)
+  local n = 0
+  repeat n = n + 1 until collectgarbage("stepus", 1000) or n > 100000
+  assert(collectgarbage("stats").cycles == cycles + 1, "no cycle completed")
+  assert(collectgarbage("stepus", 10^9) == true)  -- a whole cycle in time
+  collectgarbage("restart")
+  big = nil
+  -- generational mode: each step runs a whole (minor) collection
+  collectgarbage("generational")
+  cycles = collectgarbage("stats").cycles
+  assert(collectgarbage("stepus", 1) == true)
+  assert(collectgarbage("stats").cycles > cycles)
+  collectgarbage("incremental")
+end
+
+
+print("Collector statistics and timed steps: OK")
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+
+/* Cleared by the count hook when any Lua code runs, i.e. when
+ * luaL_loaddata fell back to loading and calling the chunk. */
+static int fastpath;
+
+static void LUAF_hook(lua_State *L, lua_Debug *ar)
+{
+	(void)L; (void)ar;
+	fastpath = 0;
+}
+
+/* loaddata(chunk) -> ok, value or message, read without running code */
+static int LUAF_loaddata(lua_State *L)
+{
+	size_t size;
+	const char *chunk = luaL_checklstring(L, 1, &size);
+	int status;
+	lua_settop(L, 1);
+					/* chunk */
+	fastpath = 1;
+	lua_sethook(L, LUAF_hook, LUA_MASKCOUNT, 1);
+	status = luaL_loaddata(L, chunk, size, "=data");
+					/* chunk value */
+	lua_sethook(L, NULL, 0, 0);
+	lua_pushboolean(L, status == LUA_OK);
+					/* chunk value ok */
+	lua_insert(L, 2);
+					/* chunk ok value */
+	lua_pushboolean(L, status == LUA_OK && fastpath);
+					/* chunk ok value fast */
+	return 3;
+}
+
+static int LUAF_onerror(lua_State *L)
+{
+	luaL_traceback(L, L, lua_tostring(L, 1), 1);
+	printf("%s\n", lua_tostring(L, -1));
+	return 1;
+}
+
+int main(int argc, char** argv)
+{
+	lua_State* L;
+	int status;
+	if (argc < 2) {
+		printf("Usage: loaddata <script>\n");
+		return 1;
+	}
+	L = luaL_newstate();
+
+	luaL_openlibs(L);
+	lua_settop(L, 0);
+
+	lua_register(L, "loaddata", LUAF_loaddata);
+
+	lua_pushcfunction(L, LUAF_onerror);
+	status = luaL_loadfile(L, argv[1]);
+	if (status == LUA_OK) {
+		status = lua_pcall(L, 0, 0, 1);
+	}
+	else {
+		printf("%s\n", lua_tostring(L, -1));
+	}
+
+	lua_close(L);
+
+	return status == LUA_OK ? 0 : 1;
+}
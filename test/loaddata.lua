@@ -0,0 +1,115 @@
+-- Differential test for luaL_loaddata. Each chunk is read through the
+-- data loader (the 'loaddata' function of test/loaddata.c) and through
+-- load() plus a call; results, or the fact that both fail, must agree.
+-- Chunks in 'fast' must also be read without running any code. Run by
+-- `make test`, or directly as
+--   test/loaddata test/loaddata.lua
+
+local fast = {
+  -- numbers
+  "return 0", "return -0", "return - 0", "return -0.0", "return -.0",
+  "return 3.", "return .5", "return 1e10", "return 1E-2", "return 2e+3",
+  "return 08", "return 1" .. string.rep("0", 400),
+  "return 9007199254740993", "return -1.5e-300",
+  "return 0x10", "return 0XfF", "return 0xA.8p1", "return 0x.1p4",
+  "return 0x1P-2", "return -0x0", "return 0x" .. string.rep("f", 40),
+  -- strings and escapes
+  "return 'plain'", 'return "double"', "return ''",
+  [[return "a\tb\\\"\'\65\066\x41\x7a"]],
+  [[return "\a\b\f\v\r\n"]],
+  [[return "\0\255\1234"]],
+  [[return 'a\z
+        b']],
+  -- long brackets
+  "return [[abc]]", "return [[\nabc]]", "return [[\n\nabc]]",
+  "return [[\r\nx]]", "return [[\n\ry]]", "return [==[a]]b]=]c]==]",
+  "return [=[\n]]]=]", "return [[]]",
+  -- comments and separators
+  "return --[[c]] 1 -- x", "--x\nreturn {a = 1, --[==[ ]==] b = 2}",
+  "return 1;", "return 1 ; -- done",
+  -- keywords
+  "return nil", "return true", "return false",
+  "return {true, false, nil, x = nil}",
+  -- tables
+  "return {}", "return {1, 2, 3,}", "return {1; 2; 3}",
+  "return {{1, {2, {3}}}, k = {a = 'b'}}",
+  "return {x = 1, x = 2}", "return {['x'] = 1, x = 2}",
+  "return {[1.5] = 'f', [-0] = 'z', [true] = 't'}",
+  "return {1, 2, [2] = 'x', 3}", "return {[1] = 'a', 'b'}",
+  "return {'a', [1] = 'b'}", "return {[3] = 'c', 'a', 'b'}",
+  "return {nil, nil, 3}", "return {1, nil}",
+}
+
+-- SETLIST flushes positional values in batches, so an explicit key is
+-- overwritten only by positional values flushed after it.
+do
+  local parts = {}
+  for i = 1, 120 do
+    parts[#parts + 1] = tostring(i)
+    if i % 7 == 0 then
+      parts[#parts + 1] = string.format("[%d] = 'k%d'", i + 3, i)
+      parts[#parts + 1] = string.format("[%d] = 'b%d'", i - 3, i)
+    end
+  end
+  parts[#parts + 1] = "[200] = 'last'"
+  fast[#fast + 1] = "return {" .. table.concat(parts, ", ") .. "}"
+end
+
+-- not plain data, or malformed: the loader must fall back to load()
+local other = {
+  "return 1..2", "return 0x", "return 1e", "return 1e+", "return 3x",
+  "return 0xg", "return .e1", "return 1.2.3", "return 0x1p", "return -",
+  "return - 'a'", "return -'2'", "return --[[x]] -1", "return - -1",
+  "return 'a\\\nb'", "return 'unterminated", "return [[unterminated",
+  "return 'bad\\q'", "return '\\256'", "return '\\x4'", "return 'a\nb'",
+  "return [[a\rb]]", "return [=[a]]", "return {,}", "return {a = }",
+  "return {[nil] = 1}", "return {1 2}", "return {a == 1}", "return {",
+  "return 1;;", "return 1 2", "return", "", "x = 1 return x",
+  "return 1 + 2", "return {f = print}", "return {x = y}",
+  "return {[{}] = 1}.x", "return math.huge", "return (1)",
+  "return {end = 1}", "return {['end'] = 1}", "return {nil = 1}",
+  "return true and 1", "return #'abc'", "return {...}",
+  "#!shebang\nreturn 1",
+}
+
+local function same(a, b)
+  if type(a) ~= type(b) then return false end
+  if type(a) == "number" then
+    if a ~= a then return b ~= b end
+    return a == b and (a ~= 0 or 1 / a == 1 / b)  -- tell -0 from 0
+  end
+  if type(a) ~= "table" then return a == b end
+  for k, v in pairs(a) do
+    if not same(v, rawget(b, k)) then return false end
+  end
+  for k in pairs(b) do
+    if rawget(a, k) == nil then return false end
+  end
+  return true
+end
+
+local function check(chunk, mustbefast)
+  local ok1, v1, isfast = loaddata(chunk)
+  local f = load(chunk, "=data")
+  local ok2, v2
+  if f then ok2, v2 = pcall(f) else ok2 = false end
+  local name = string.format("%q", #chunk > 60 and chunk:sub(1, 60) .. "..."
+                                                 or chunk)
+  assert(ok1 == ok2, name .. ": loaddata " .. (ok1 and "succeeded" or
+         "failed") .. ": " .. tostring(v1))
+  assert(not ok1 or same(v1, v2), name .. ": values differ")
+  assert(not mustbefast or isfast, name .. ": not read as data")
+  return isfast
+end
+
+local nfast = 0
+for _, chunk in ipairs(fast) do
+  check(chunk, true)
+  nfast = nfast + 1
+end
+for _, chunk in ipairs(other) do
+  if check(chunk, false) then nfast = nfast + 1 end
+end
+
+print(string.format("Data loader: %d chunks agree, %d read as data",
+                    #fast + #other, nfast))
@@ -0,0 +1,73 @@
+-- Tests for the allocation profiler (profile.memstart, memstop and
+-- memreport). Run by `make test` through the test driver, which checks
+-- that the state's allocator is restored, or directly as
+--   test/alloc test/memprofile.lua
+
+local profile = require "profile"
+local src = "test/memprofile.lua"
+
+local function site(report, line)
+  for _, s in ipairs(report) do
+    if s.source == src and s.line == line then return s end
+  end
+end
+
+assert(profile.memreport() == nil)
+profile.memstop()  -- not running: nothing to do
+assert(sameallocator())
+
+assert(not pcall(profile.memstart, 0))
+profile.memstart(64)  -- (sample almost every block)
+assert(not sameallocator())
+local keep, line = {}, debug.getinfo(1, "l").currentline + 1
+for i = 1, 1000 do keep[i] = {i} end
+for i = 1, 1000 do local _ = {i} end  -- garbage
+local co = coroutine.wrap(function()
+  local t = {}
+  for i = 1, 100 do t[i] = {i} end
+  coroutine.yield(t)
+end)
+local cokeep, coline = co(), debug.getinfo(1, "l").currentline - 3
+
+local report = profile.memreport()
+local s = site(report, line)
+assert(s, "allocations not charged to their line")
+assert(s.nlive > 0 and s.ntotal >= s.nlive)
+assert(s.live >= 64 * s.nlive and s.total >= s.live)
+local g = site(report, line + 1)
+assert(g and g.ntotal > 0 and g.total >= 64 * g.ntotal)
+local c = site(report, coline)
+assert(c and c.nlive > 0, "coroutine allocations not charged to their line")
+for i = 2, #report do  -- largest live heap first
+  local a, b = report[i - 1], report[i]
+  assert(a.live > b.live or (a.live == b.live and a.total >= b.total),
+         "report not sorted")
+end
+for _, r in ipairs(report) do
+  assert(type(r.source) == "string" and type(r.line) == "number")
+  assert(r.live >= 0 and r.live <= r.total and r.nlive <= r.ntotal)
+end
+
+-- freed blocks leave the live heap but stay in the totals
+keep, cokeep = nil, nil
+collectgarbage()
+report = profile.memreport()
+local s2 = site(report, line)
+assert(s2.live == 0 and s2.nlive == 0, "freed blocks still live")
+assert(s2.total == s.total and s2.ntotal == s.ntotal)
+
+-- restarting starts over with empty statistics
+profile.memstart(64)
+assert(site(profile.memreport(), line) == nil)
+
+-- stopping restores the state's own allocator
+profile.memstop()
+assert(sameallocator(), "allocator not restored")
+assert(profile.memreport() == nil)
+profile.memstop()
+collectgarbage()
+
+-- a state closed with the profiler running removes it
+profile.memstart()
+
+print("Allocation profiler: OK")
@@ -0,0 +1,193 @@
+-- Differential test for the bytecode optimizer (see debug.optimize). Each
+-- chunk below is compiled with and without the optimizer and run on the
+-- same inputs; results and error messages must be identical, and the
+-- optimized code must not be larger. Run by `make test`, or directly as
+--   src/lua test/optimize.lua
+
+local chunks = {}
+
+chunks[#chunks + 1] = [[
+local a, b = ...
+if a then
+  if b then return 1 else return 2 end
+elseif b then
+  return 3
+end
+return 4
+]]
+
+chunks[#chunks + 1] = [[
+local n = ...
+local sum = 0
+while true do
+  if n <= 0 then break end
+  if n % 3 == 0 then
+    sum = sum + n
+  elseif n % 3 == 1 then
+    sum = sum - 1
+  else
+    sum = sum * 2
+  end
+  n = n - 1
+end
+return sum
+]]
+
+chunks[#chunks + 1] = [[
+local n = ...
+local out = {}
+for i = 1, n do
+  for j = i, 1, -1 do
+    if (i + j) % 4 == 0 then goto continue end
+    out[#out + 1] = i * j
+    ::continue::
+  end
+end
+repeat
+  n = n - 1
+  local x = n
+  if x == 2 then break end
+until x <= 0
+return #out, n, out[1], out[#out]
+]]
+
+chunks[#chunks + 1] = [[
+local a, b = ...
+local function f(x) return x and b or a end
+local t = {a = a and 1, b = b or 2, c = not a, d = a == b, e = a ~= nil}
+return f(a), f(b), f(nil), t.a, t.b, t.c, t.d, t.e, (a and b) or (b and a)
+]]
+
+chunks[#chunks + 1] = [[
+local n = ...
+local fs = {}
+for i = 1, n do
+  local j = i
+  fs[i] = function() j = j + 1; return j end
+  if i % 2 == 0 then goto skip end
+  do
+    local k = i * 10
+    fs[#fs + 1] = function() return k end
+  end
+  ::skip::
+end
+while n > 0 do
+  local v = n
+  fs[#fs + 1] = function() return v end
+  if v % 2 == 1 then n = n - 1 else n = n - 2 end
+end
+local r = {}
+for i, f in ipairs(fs) do r[i] = f() end
+return table.concat(r, ",")
+]]
+
+chunks[#chunks + 1] = [[
+local t = ...
+local keys = {}
+for k, v in pairs(t or {x = 1, y = 2}) do
+  if type(v) == "number" then keys[#keys + 1] = k end
+end
+table.sort(keys)
+local function va(...)
+  local n = select("#", ...)
+  if n == 0 then return end
+  return n, ...
+end
+return table.concat(keys), va(), va(1, nil, 3)
+]]
+
+chunks[#chunks + 1] = [[
+local a = ...
+if a == 1 then
+  error("one")
+elseif a == 2 then
+  local x = nil
+  return x.field
+elseif a == 3 then
+  return a + {}
+end
+return a
+]]
+
+chunks[#chunks + 1] = [[
+local n = ...
+local t = {1, 2, 3, n, n and n + 1, nil, [20] = 5}
+local s = 0
+for i = 1, 20 do
+  local v = t[i]
+  if not v then
+  else
+    s = s + v
+  end
+end
+return s, #t > 0, t[20]
+]]
+
+local inputs = {
+  {}, {true}, {false, true}, {true, false}, {nil, true}, {0}, {1}, {2},
+  {3}, {5}, {10}, {{a = 1, b = "x", c = 3}},
+}
+
+local function pack(...)
+  return {n = select("#", ...), ...}
+end
+
+local function run(f, args)
+  local r = pack(pcall(f, table.unpack(args, 1, 3)))
+  for i = 1, r.n do
+    if type(r[i]) == "table" or type(r[i]) == "function" then
+      r[i] = type(r[i])
+    end
+  end
+  return r
+end
+
+local function same(r1, r2)
+  if r1.n ~= r2.n then return false end
+  for i = 1, r1.n do
+    if r1[i] ~= r2[i] then return false end
+  end
+  return true
+end
+
+local function compile(src, name, optimize)
+  local old = debug.optimize(optimize)
+  local f = assert(load(src, name))
+  debug.optimize(old)
+  return f
+end
+
+local saved, removed = 0, 0
+for n, src in ipairs(chunks) do
+  local name = "=chunk" .. n
+  local plain, opt = compile(src, name, false), compile(src, name, true)
+  local dplain, dopt = string.dump(plain), string.dump(opt)
+  assert(#dopt <= #dplain, name .. ": optimized code is larger")
+  saved = saved + #dplain - #dopt
+  for _, args in ipairs(inputs) do
+    local r1, r2 = run(plain, args), run(opt, args)
+    if not same(r1, r2) then
+      error(string.format("%s: results differ for (%s): %s / %s", name,
+            table.concat({tostring(args[1]), tostring(args[2])}, ", "),
+            tostring(r1[2]), tostring(r2[2])))
+    end
+  end
+  if #dopt < #dplain then removed = removed + 1 end
+end
+
+-- the test files themselves must compile to no larger code
+for _, file in ipairs{"test/persist.lua", "test/unpersist.lua",
+                      "test/bench.lua", "test/optimize.lua"} do
+  local fh = io.open(file)
+  if fh then
+    local src = fh:read("*a")
+    fh:close()
+    local plain = string.dump(compile(src, "@" .. file, false))
+    local opt = string.dump(compile(src, "@" .. file, true))
+    assert(#opt <= #plain, file .. ": optimized code is larger")
+    saved = saved + #plain - #opt
+  end
+end
+
+print(string.format("Optimizer: %d chunks agree, %d shrunk, %d bytes saved",
+                    #chunks, removed, saved))
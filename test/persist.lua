@@ -42,6 +42,16 @@ nantable[1] = 0/0
 
 rootobj.testnan = nantable
 
+-------------------------------------------------------------------------------
+-- Compact number encoding (stored as data persisted with that setting).
+
+eris.settings("compact", true)
+rootobj.testcompact = eris.persist({
+  0, -0.0, 1, -1, 63, -64, 64, 2^31, -2^53, 2^53, 2^53 + 2, 0.5, -1e300,
+  math.huge, -math.huge, 0/0
+})
+eris.settings("compact", nil)
+
 -------------------------------------------------------------------------------
 -- Cycles in tables.
 
@@ -0,0 +1,67 @@
+-- Tests for the sampling profiler (profile.start, stop, folded and reset).
+-- Run by `make test`, or directly as
+--   src/lua test/profile.lua
+
+local profile = require "profile"
+if not pcall(profile.start) then
+  print("Profiler: not supported on this platform, skipped")
+  return
+end
+profile.reset()
+
+local function spin(seconds)  -- spends 'seconds' of CPU time in Lua
+  local t, x = os.clock(), 0
+  while os.clock() - t < seconds do x = x + 1 end
+  return x
+end
+
+local function outer()
+  local x = spin(1.5)  -- (timer ticks may be as coarse as 4ms)
+  return x
+end
+
+-- the folded output before any sample
+assert(profile.folded() == "")
+assert(profile.stop() == nil)
+
+assert(not pcall(profile.start, 0))
+profile.start(0.001)
+local ok, msg = pcall(profile.start)
+assert(not ok and msg:find("already running"), msg)
+outer()
+local n = profile.stop()
+assert(n > 256, "too few samples: " .. n)  -- more than a ring of samples
+spin(0.05)  -- not sampled
+assert(profile.stop() == n)
+
+-- one line per stack, "frame;frame;... count", sorted, summing up to 'n'
+local out = profile.folded()
+local main = "main chunk (test/profile.lua:0)"
+local inner = main .. ";outer (test/profile.lua:18);spin (test/profile.lua:12)"
+local total, last, seen = 0, nil, false
+for line in out:gmatch("([^\n]*)\n") do
+  local stack, count = line:match("^(.+) (%d+)$")
+  assert(stack, "bad line: " .. line)
+  assert(last == nil or last < stack, "stacks not sorted")
+  last = stack
+  total = total + tonumber(count)
+  assert(stack:find(main, 1, true), "outermost frames missing: " .. stack)
+  if stack:sub(-#inner) == inner then seen = true end  -- innermost last
+end
+assert(out:sub(-1) == "\n" and total == n, "samples lost")
+assert(seen, "no sample inside 'spin'")
+assert(profile.folded() == out)  -- reading does not consume the samples
+
+-- samples accumulate over runs until 'reset'
+profile.start(0.001)
+spin(0.1)
+assert(profile.stop() > n)
+profile.reset()
+assert(profile.folded() == "" and profile.stop() == nil)
+profile.start(0.001)
+spin(0.1)
+local m = profile.stop()
+assert(m > 0 and m < n, "reset kept old samples")
+profile.reset()
+
+print("Profiler: OK")
@@ -0,0 +1,360 @@
+-- Tests for the table library: table.sort (introsort, with the fast path
+-- for arrays of only numbers or only strings), table.concat (presized in
+-- a first pass) and the bulk operations table.create, move, clear and
+-- fill. Run by `make test`, or directly as
+--   src/lua test/table.lua
+
+math.randomseed(42)
+
+local function copy(t, n)
+  local c = {}
+  for i = 1, n or #t do c[i] = t[i] end
+  return c
+end
+
+local function refsort(t, lt)  -- insertion sort as a reference
+  lt = lt or function(a, b) return a < b end
+  t = copy(t)
+  for i = 2, #t do
+    local v, j = t[i], i - 1
+    while j >= 1 and lt(v, t[j]) do t[j + 1] = t[j]; j = j - 1 end
+    t[j + 1] = v
+  end
+  return t
+end
+
+local function same(a, b, n, what)
+  for i = 1, n or math.max(#a, #b) do
+    assert(a[i] == b[i], string.format("%s: differs at %d", what, i))
+  end
+end
+
+local function randomstring()
+  local t = {}
+  for i = 1, math.random(0, 4) do
+    t[i] = string.char(math.random(0, 3) == 0 and 0 or math.random(97, 100))
+  end
+  return table.concat(t)
+end
+
+local desc = function(a, b) return a > b end
+
+-- sizes around the insertion sort cutoff, on both paths
+for n = 0, 40 do
+  for _, gen in ipairs{math.random, randomstring,
+                       function() return math.random(3) end} do
+    local t = {}
+    for i = 1, n do t[i] = gen() end
+    local s = copy(t); table.sort(s)
+    same(s, refsort(t), n, "plain sort of " .. n)
+    s = copy(t); table.sort(s, desc)
+    same(s, refsort(t, desc), n, "sort with comparator of " .. n)
+  end
+end
+
+-- presorted, reversed and constant inputs
+for _, n in ipairs{100, 1000, 5000} do
+  local up, down, flat = {}, {}, {}
+  for i = 1, n do up[i] = i; down[i] = n - i; flat[i] = 7 end
+  for _, t in ipairs{up, down, flat} do
+    local s = copy(t); table.sort(s)
+    for i = 2, n do assert(s[i - 1] <= s[i]) end
+    s = copy(t); table.sort(s, desc)
+    for i = 2, n do assert(s[i - 1] >= s[i]) end
+  end
+end
+
+-- McIlroy's adversary builds an input that drives quicksort into its
+-- worst case; introsort must switch to heapsort and stay O(n log n)
+do
+  local n = 2000
+  local val, gas, nsolid, candidate = {}, n + 1, 0, nil
+  local ncomp = 0
+  local x = {}
+  for i = 1, n do x[i] = i; val[i] = gas end
+  local function freeze(i) val[i] = nsolid; nsolid = nsolid + 1 end
+  table.sort(x, function(a, b)
+    ncomp = ncomp + 1
+    if val[a] == gas and val[b] == gas then
+      if a == candidate then freeze(a) else freeze(b) end
+    end
+    if val[a] == gas then candidate = a
+    elseif val[b] == gas then candidate = b end
+    return val[a] < val[b]
+  end)
+  assert(ncomp < 10 * n * 11, "quadratic number of comparisons: " .. ncomp)
+  for i = 2, n do assert(val[x[i - 1]] <= val[x[i]]) end
+  for i = 1, n do  -- the same input, frozen, on both paths
+    if val[i] == gas then freeze(i) end
+  end
+  local s = copy(val)
+  ncomp = 0
+  table.sort(s, function(a, b) ncomp = ncomp + 1; return a < b end)
+  assert(ncomp < 10 * n * 11, "quadratic number of comparisons: " .. ncomp)
+  for i = 1, n do assert(s[i] == i - 1) end
+  s = copy(val)
+  table.sort(s)
+  for i = 1, n do assert(s[i] == i - 1) end
+end
+
+-- strings with embedded zeros compare like '<'
+do
+  local t = {"a\0b", "a\0a", "a", "a\0", "", "\0", "\0\0", "b", "a\0\0",
+             "ab", "a\0b\0", "\0a"}
+  for i = 1, 20 do t[#t + 1] = randomstring() end
+  local s = copy(t); table.sort(s)
+  same(s, refsort(t), #t, "strings with zeros")
+  for i = 2, #s do assert(not (s[i] < s[i - 1])) end
+end
+
+-- mixed types and NaN go through the generic path
+do
+  local ok, msg = pcall(table.sort, {3, 1, "2", 5, 4})
+  assert(not ok and msg:find("compare"), msg)
+  ok, msg = pcall(table.sort, {"b", "a", 1})
+  assert(not ok and msg:find("compare"), msg)
+  ok, msg = pcall(table.sort, {1, 2, {}, 3})
+  assert(not ok and msg:find("compare"), msg)
+  local nan = 0/0
+  for _, n in ipairs{5, 50} do
+    local t = {}
+    for i = 1, n do t[i] = (i % 4 == 0) and nan or math.random(10) end
+    local s = copy(t)
+    ok, msg = pcall(table.sort, s)  -- no defined order, but no harm either
+    assert(ok or msg:find("invalid order function"), msg)
+    local count = 0
+    for i = 1, n do if s[i] ~= s[i] then count = count + 1 end end
+    assert(count == math.floor(n / 4))
+  end
+  -- the fast path looks at the ends before allocating anything
+  local huge = setmetatable({}, {__len = function() return 2^28 end})
+  ok, msg = pcall(table.sort, huge)
+  assert(not ok and msg:find("compare"), msg)
+  huge[1] = 5
+  ok, msg = pcall(table.sort, huge)
+  assert(not ok and msg:find("compare"), msg)
+  local lt = {__lt = function(a, b) return a[1] < b[1] end}
+  local objs = {}
+  for i = 1, 50 do objs[i] = setmetatable({(i * 37) % 50}, lt) end
+  table.sort(objs)
+  for i = 1, 50 do assert(objs[i][1] == i - 1) end
+  local s = {3, 1, 2}  -- a comparator disables the fast path
+  table.sort(s, function(a, b) return a < b end)
+  same(s, {1, 2, 3}, 3, "comparator")
+end
+
+-- an inconsistent order function is reported, not a crash
+do
+  local t = {}
+  for i = 1, 100 do t[i] = i end
+  local ok, msg = pcall(table.sort, t, function() return true end)
+  assert(not ok and msg:find("invalid order function"), msg)
+  for i = 1, 100 do t[i] = i % 3 end
+  ok, msg = pcall(table.sort, t, function(a, b) return a <= b end)
+  assert(not ok and msg:find("invalid order function"), msg)
+end
+
+-- table.concat
+do
+  local function slow(t, sep, i, j)  -- reference: concatenation with '..'
+    local s = ""
+    for k = i or 1, j or #t do
+      s = s .. t[k] .. (k < (j or #t) and sep or "")
+    end
+    return s
+  end
+  assert(table.concat({}) == "" and table.concat({}, "x") == "")
+  assert(table.concat({1, 2}, ",", 3, 2) == "")  -- i > last
+  assert(table.concat({1, 2}, ",", 2, 1) == "")
+  assert(table.concat({"a"}, ",", 1, 0) == "")
+  local mixed = {1, "a", 2.5, -0.0, 1e300, -2^53, "", "\0z", 1/0, 0.1}
+  for _, sep in ipairs{"", ",", "\0", string.rep("-=", 5000)} do
+    assert(table.concat(mixed, sep) == slow(mixed, sep))
+    assert(table.concat(mixed, sep, 3, 7) == slow(mixed, sep, 3, 7))
+    assert(table.concat(mixed, sep, 4, 4) == slow(mixed, sep, 4, 4))
+  end
+  local long = {}
+  for i = 1, 1000 do long[i] = (i % 3 == 0) and i * 1.5 or string.rep("s", i) end
+  assert(table.concat(long, ";") == slow(long, ";"))
+  -- ranges ending at INT_MAX must not wrap around
+  local maxint = 2^31 - 1
+  local t = {[maxint - 1] = "y", [maxint] = "x"}
+  assert(table.concat(t, ",", maxint, maxint) == "x")
+  assert(table.concat(t, ",", maxint - 1, maxint) == "y,x")
+  local ok, msg = pcall(table.concat, t, ",", maxint - 2, maxint)
+  assert(not ok and msg:find("invalid value %(nil%) at index 2147483645"), msg)
+  -- invalid values
+  ok, msg = pcall(table.concat, {1, {}, 3})
+  assert(not ok and msg:find("invalid value %(table%) at index 2 in table " ..
+                             "for 'concat'"), msg)
+  ok, msg = pcall(table.concat, {1, 2, 3}, ",", 1, 4)
+  assert(not ok and msg:find("invalid value %(nil%) at index 4"), msg)
+  -- finalizers run by the allocations of the second pass (the buffer, and
+  -- converting numbers) may change the table; a piece that no longer fits
+  -- makes it start over
+  local base = {}
+  for i = 1, 100 do base[i] = (i % 10 == 0) and i or string.rep("v", 100) end
+  local before, changed = table.concat(base), 0
+  for round = 1, 300 do
+    local t = {}
+    for i = 1, 100 do t[i] = base[i] end
+    for j = 1, 20 do
+      setmetatable({}, {__gc = function() t[99] = string.rep("w", 50000) end})
+    end
+    local s = table.concat(t, "", 1, 100)
+    if s ~= before then changed = changed + 1 end
+    assert(s == before or s == table.concat(t), "round " .. round)
+  end
+  assert(changed > 0, "the finalizers never changed the table")
+end
+
+-- table.create
+do
+  local t = table.create(100, 10)
+  assert(next(t) == nil and #t == 0)
+  t = table.create(0)
+  assert(next(t) == nil)
+  assert(not pcall(table.create, -1))
+  assert(not pcall(table.create, 1, -1))
+end
+
+-- table.move
+do
+  local function check(t, expected, what)
+    for i = 1, math.max(#t, #expected) do
+      assert(t[i] == expected[i], string.format("%s: differs at %d", what, i))
+    end
+  end
+  local a = {1, 2, 3, 4, 5, 6, 7, 8}
+  assert(table.move(a, 1, 5, 3) == a)  -- overlap, copied backwards
+  check(a, {1, 2, 1, 2, 3, 4, 5, 8}, "forward overlap")
+  a = {1, 2, 3, 4, 5, 6, 7, 8}
+  table.move(a, 3, 7, 1)  -- overlap, copied forwards
+  check(a, {3, 4, 5, 6, 7, 6, 7, 8}, "backward overlap")
+  a = {1, 2, 3}
+  table.move(a, 1, 3, 1)
+  check(a, {1, 2, 3}, "onto itself")
+  table.move(a, 1, 0, 1)  -- empty range
+  table.move(a, 5, 1, 2)
+  check(a, {1, 2, 3}, "empty range")
+  -- hash parts, and ranges crossing from the array part into the hash
+  local h = {}
+  for i = 100, 110 do h[i] = i end
+  table.move(h, 100, 110, 104)
+  for i = 100, 103 do assert(h[i] == i) end
+  for i = 104, 114 do assert(h[i] == i - 4) end
+  table.move(h, 104, 114, 100)
+  for i = 100, 110 do assert(h[i] == i) end
+  a = {1, 2, 3, 4, 5}
+  table.move(a, 1, 5, 4)  -- grows 'a' while copying
+  check(a, {1, 2, 3, 1, 2, 3, 4, 5}, "array into hash")
+  a = {}
+  a[-1], a[0], a[1] = "m", "z", "o"
+  table.move(a, -1, 1, 2)
+  assert(a[2] == "m" and a[3] == "z" and a[4] == "o" and a[1] == "o")
+  -- nils are moved too, and a new table is only filled where needed
+  local b = table.move({1, nil, 3}, 1, 3, 1, {9, 9, 9})
+  check(b, {1, nil, 3}, "nil moved")
+  b = table.move({1, 2, 3}, 1, 3, 100, {})
+  assert(b[1] == nil and b[100] == 1 and b[102] == 3)
+  b = table.move({nil, nil}, 1, 2, 1, {})
+  assert(next(b) == nil)
+  -- metamethods are ignored
+  local mt = {__index = function() return "mt" end,
+              __newindex = function() error("raw access expected") end}
+  b = table.move({1, 2}, 1, 2, 1, setmetatable({}, mt))
+  assert(rawget(b, 1) == 1 and rawget(b, 2) == 2)
+  -- argument checks
+  local maxint = 2^31 - 1
+  local ok, msg = pcall(table.move, {}, 1, maxint, 2)
+  assert(not ok and msg:find("wrap around"), msg)
+  ok, msg = pcall(table.move, {}, -2, maxint - 1, 1)
+  assert(not ok and msg:find("too many elements"), msg)
+  ok, msg = pcall(table.move, {}, 1, 2, 3, 4)
+  assert(not ok and msg:find("table expected"), msg)
+  a = {}
+  table.move({7}, 1, 1, maxint, a)
+  assert(a[maxint] == 7)
+  -- the destination keeps what it gets while the collector runs: 'dst'
+  -- (a global, so marked early) turns black while the ballast is being
+  -- traversed, and values moved into it must survive the atomic phase;
+  -- a value finalized while its round's 'dst' is alive was lost
+  local ballast = {}
+  for i = 1, 20000 do ballast[i] = {} end
+  local round, lost = 0, false
+  local gcmt = {__gc = function(o) if o[2] == round then lost = true end end}
+  collectgarbage("incremental")
+  for r = 1, 20 do
+    local dst = {}
+    round = r
+    if r % 2 == 0 then  -- array part: moved as one block
+      dst = table.create(1020)
+      table.fill(dst, false, 1, 1020)
+    end
+    DST = dst
+    collectgarbage()
+    for k = 1, 50 do
+      local src = {}
+      for i = 1, 20 do src[i] = setmetatable({i, r}, gcmt) end
+      table.move(src, 1, 20, k * 20, dst)
+      collectgarbage("step", 0)
+    end
+    repeat until collectgarbage("step", 0)  -- finish the cycle
+    assert(not lost, "table.move lost a value to the collector")
+    for i = 20, 1019 do assert(dst[i][1] == (i - 20) % 20 + 1) end
+  end
+  DST = nil
+end
+
+-- table.clear
+do
+  local t = {1, 2, 3, x = 1, y = 2}
+  local mt = {__index = function() return "mt" end}
+  setmetatable(t, mt)
+  assert(t.z == "mt")
+  table.clear(t)
+  assert(next(t) == nil and t.x == "mt" and getmetatable(t) == mt)
+  t.x, t[1] = 5, 6  -- still usable
+  assert(t.x == 5 and t[1] == 6 and #t == 1)
+  -- clearing a metatable removes its metamethods (and cached absences)
+  local u = setmetatable({}, mt)
+  assert(u.x == "mt")
+  table.clear(mt)
+  assert(u.x == nil)
+  mt.__index = function() return "again" end
+  assert(u.x == "again")
+  table.clear(mt)
+  assert(u.x == nil)
+  mt.__index = {x = 1}
+  assert(u.x == 1)
+  -- the capacity is kept: refilling allocates nothing
+  local n = 1024  -- (fills the hash part: its free list is used up)
+  local c = {}
+  for i = 1, n do c[i] = i; c[i + 0.5] = i end
+  collectgarbage()
+  collectgarbage("stop")
+  table.clear(c)
+  local before = collectgarbage("count")
+  for i = 1, n do c[i] = i; c[i + 0.5] = i end
+  assert(collectgarbage("count") == before, "clear dropped the capacity")
+  collectgarbage("restart")
+  assert(not pcall(table.clear, "x"))
+end
+
+-- table.fill
+do
+  local t = {1, 2, 3}
+  table.fill(t, 0)
+  assert(t[1] == 0 and t[2] == 0 and t[3] == 0 and t[4] == nil)
+  table.fill(t, "x", 2, 5)
+  assert(t[1] == 0 and t[2] == "x" and t[5] == "x" and t[6] == nil)
+  table.fill(t, true, 4, 3)  -- empty range
+  assert(t[4] == "x")
+  local maxint = 2^31 - 1
+  t = {}
+  table.fill(t, 1, maxint, maxint)  -- must not wrap around
+  assert(t[maxint] == 1 and next(t, maxint) == nil)
+  assert(not pcall(table.fill, {}))
+end
+
+print("Table library: OK")
@@ -4,6 +4,7 @@
 #include "lua.h"
 #include "lualib.h"
 #include "lauxlib.h"
+#include "eris.h"
 
 static int LUAF_checkludata(lua_State *L)
 {
@@ -44,6 +45,47 @@ static int LUAF_boxboolean(lua_State *L)
 	return 1;
 }
 
+/* Unpersists a file through the prefetching reader, using small chunks to
+ * exercise reads crossing chunk boundaries. */
+static int undump(lua_State *L)
+{
+					/* perms pf */
+	eris_Prefetch *pf = (eris_Prefetch*)lua_touserdata(L, 2);
+	lua_settop(L, 1);
+					/* perms */
+	eris_undump(L, eris_prefetch_reader, pf);
+					/* perms rootobj */
+	return 1;
+}
+
+static int LUAF_undumpfile(lua_State *L)
+{
+					/* perms filename */
+	eris_Prefetch *pf;
+	int status;
+	FILE *file = fopen(luaL_checkstring(L, 2), "rb");
+	if (file == NULL) {
+		return luaL_error(L, "cannot open file");
+	}
+	pf = eris_prefetch_open(file, 4, 64);
+	if (pf == NULL) {
+		fclose(file);
+		return luaL_error(L, "cannot start prefetching reader");
+	}
+	lua_pushcfunction(L, undump);
+	lua_pushvalue(L, 1);
+	lua_pushlightuserdata(L, pf);
+					/* perms filename undump perms pf */
+	status = lua_pcall(L, 2, 1, 0);
+					/* perms filename rootobj/err */
+	eris_prefetch_close(pf);
+	fclose(file);
+	if (status != LUA_OK) {
+		return lua_error(L);
+	}
+	return 1;
+}
+
 static int LUAF_onerror(lua_State *L)
 {
 
@@ -71,6 +113,7 @@ int main(int argc, char** argv)
 	lua_register(L, "unboxinteger", LUAF_unboxinteger);
 	lua_register(L, "boxboolean", LUAF_boxboolean);
 	lua_register(L, "unboxboolean", LUAF_unboxboolean);
+	lua_register(L, "undumpfile", LUAF_undumpfile);
 	lua_register(L, "onerror", LUAF_onerror);
 
 	lua_pushcfunction(L, LUAF_onerror);
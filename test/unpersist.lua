@@ -11,6 +11,151 @@ function testuvinthread(func)
   return success and result == 5
 end
 
+function testcompact(data)
+  local t = eris.unpersist(data)
+  local expected = {
+    0, -0.0, 1, -1, 63, -64, 64, 2^31, -2^53, 2^53, 2^53 + 2, 0.5, -1e300,
+    math.huge, -math.huge
+  }
+  for i = 1, #expected do
+    if t[i] ~= expected[i] or 1/t[i] ~= 1/expected[i] then
+      return false
+    end
+  end
+  return t[16] ~= t[16]
+end
+
+function testmaxmem()
+  local data = eris.persist({string.rep("x", 100000)})
+  eris.settings("maxmem", 50000)
+  local ok1, err1 = pcall(eris.unpersist, data)
+  eris.settings("maxmem", 1000000)
+  local ok2 = pcall(eris.unpersist, data)
+  eris.settings("maxmem", 0)
+  local ok3, err3 = pcall(eris.unpersist, data:sub(1, 1000))
+  return not ok1 and err1:find("memory limit exceeded") ~= nil and ok2 and
+         not ok3 and err3:find("invalid string size") ~= nil
+end
+
+function testprefetch(filename)
+  local ok, rootobj = pcall(undumpfile, uperms, filename)
+  return ok and rootobj.testseven == 7 and rootobj.testfoobar == "foobar" and
+         rootobj.testtbl.a == 2 and rootobj.testthread ~= nil
+end
+
+-- Counts the temporary files ("name.*.tmp") next to 'name', or returns nil
+-- if the directory cannot be listed.
+local function tempfiles(name)
+  local dir, base = name:match("^(.-)([^/\\]*)$")
+  local ok, ls = pcall(io.popen, dir == "" and "ls -a" or "ls -a '" .. dir .. "'")
+  if not ok or not ls then return nil end
+  local n, listed = 0, false
+  for file in ls:lines() do
+    listed = true
+    if file:sub(1, #base + 1) == base .. "." and file:sub(-4) == ".tmp" then
+      n = n + 1
+    end
+  end
+  ls:close()
+  return listed and n or nil
+end
+
+function testautosave(filename)
+  local name = filename .. ".autosave"
+  local stats
+  -- make sure leftovers would be seen
+  local probe = io.open(name .. ".probe.tmp", "wb")
+  probe:close()
+  local probed = tempfiles(name)
+  os.remove(name .. ".probe.tmp")
+  for i = 1, 3 do
+    stats = eris.autosave(name, nil, {generation = i}, 2)
+  end
+  local function load(path)
+    local file = io.open(path, "rb")
+    if not file then return nil end
+    local data = file:read("*a")
+    file:close()
+    return eris.unpersist(data).generation
+  end
+  local current, first, second = load(name), load(name .. ".1"), load(name .. ".2")
+  local leftover = probed and tempfiles(name)
+  os.remove(name)
+  os.remove(name .. ".1")
+  os.remove(name .. ".2")
+  return current == 3 and first == 2 and second == 1 and
+         (probed == nil or (probed == 1 and leftover == 0)) and
+         stats.bytes > 0 and stats.total >= stats.persist + stats.sync
+end
+
+function testbundle(filename)
+  local modfile = filename .. ".mod.lua"
+  local bundlefile = filename .. ".bundle"
+  local file = io.open(modfile, "wb")
+  file:write("local name = ...\nreturn {name = name, env = type(print)}\n")
+  file:close()
+  local count = eris.bundle(bundlefile, {["bundled.mod"] = modfile})
+  os.remove(modfile)
+  file = io.open(bundlefile, "rb")
+  local header = file:read(12)  -- magic, then version and count, little endian
+  file:close()
+  local searcher = eris.loadbundle(bundlefile)
+  local ok, mod = pcall(require, "bundled.mod")
+  for i = #package.searchers, 1, -1 do
+    if package.searchers[i] == searcher then
+      table.remove(package.searchers, i)
+    end
+  end
+  package.loaded["bundled.mod"] = nil
+  os.remove(bundlefile)
+  return count == 1 and ok and mod.name == "bundled.mod" and
+         mod.env == "function" and header == "ERSB\1\0\0\0\1\0\0\0"
+end
+
+function testchecksum(filename)
+  local name = filename .. ".checksum"
+  eris.settings("checksum", true)
+  local data = eris.persist({1, "two", {3}})
+  eris.settings("checksum", nil)
+  -- Corrupt a string so that decoding itself succeeds.
+  local pos = data:find("two", 1, true) + 1
+  local bad = data:sub(1, pos - 1) .. string.char((data:byte(pos) + 1) % 256) ..
+              data:sub(pos + 1)
+  local function streamed(data)
+    local file = io.open(name, "wb")
+    file:write(data)
+    file:close()
+    local ok, result = pcall(undumpfile, {}, name)
+    os.remove(name)
+    return ok, result
+  end
+  local ok1, err1 = pcall(eris.unpersist, bad)
+  local ok2, t = streamed(data)
+  local ok3, err3 = streamed(bad)
+  return eris.unpersist(data)[2] == "two" and
+         not ok1 and err1:find("checksum mismatch") ~= nil and
+         ok2 and t[3][1] == 3 and
+         not ok3 and err3:find("checksum mismatch") ~= nil
+end
+
+function testmany()
+  local lib = {}
+  local items = {}
+  for i = 1, 10 do
+    items[i] = function() return lib, i end
+  end
+  local data = eris.persist_many(nil, items)
+  local total = 0
+  for i = 1, #items do
+    total = total + #eris.persist(items[i])
+  end
+  local lib3, i3 = eris.unpersist_one(data, 3)()
+  local lib7, i7 = eris.unpersist_one(data, 7)()
+  local ok = pcall(eris.unpersist_one, data, 11)
+  return i3 == 3 and i7 == 7 and lib3 == lib7 and lib3 ~= lib and
+         #data < total and not ok
+end
+
 function test(rootobj)
   local passed = 0
   local total = 0
@@ -33,6 +178,7 @@ function test(rootobj)
   dotest("String 'foobar'        ", rootobj.testfoobar == "foobar")
   dotest("Table                  ", rootobj.testtbl.a == 2 and rootobj.testtbl[2] == 4)
   dotest("NaN value              ", rootobj.testnan[1] ~= rootobj.testnan[1])
+  dotest("Compact numbers        ", testcompact(rootobj.testcompact))
   dotest("Looped tables          ", rootobj.testlooptable.testloopb.testloopa == rootobj.testlooptable)
   dotest("Table metatable        ", rootobj.testmt() == 21)
   dotest("__newindex metamethod  ", rootobj.testniinmt.a == 3)
@@ -58,6 +204,12 @@ function test(rootobj)
   dotest("Yielded metafunc       ", coroutine.resume(rootobj.testymtthr) == true, true)
   dotest("Deep callstack         ", rootobj.testdeep() == 100)
   dotest("Tail call              ", rootobj.testtail() == 100)
+  dotest("Prefetching reader     ", testprefetch(filename))
+  dotest("Memory limit           ", testmaxmem())
+  dotest("Autosave               ", testautosave(filename))
+  dotest("Module bundle          ", testbundle(filename))
+  dotest("Checksum               ", testchecksum(filename))
+  dotest("Persist many           ", testmany())
 
   print()
   if passed == total then
@@ -74,7 +226,8 @@ end
 
 -------------------------------------------------------------------------------
 
-infile, err = io.open(..., "rb")
+filename = ...
+infile, err = io.open(filename, "rb")
 if infile == nil then
   error("While opening: " .. (err or "unknown error"))
 end